@@ -0,0 +1,97 @@
+// Bench
+// MIT License. Copyright 2023 Mirko Palmer (derbroti)
+////////
+
+// Minimal benchmark harness, writes its results in Google Benchmark's JSON layout.
+//
+// A benchmark is a name and a function taking a Run: it prepares its input untimed, then times
+// its loop body with Run::measure(). Each benchmark is repeated until it ran for the minimum time.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+class Run {
+public:
+    // f() processes items values of bytes bytes in total per call
+    template <typename F>
+    void measure(size_t items, size_t bytes, F f) {
+        auto t0 = std::chrono::steady_clock::now();
+        f();
+        seconds     += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        this->items += items;
+        this->bytes += bytes;
+        ++iterations;
+    }
+
+private:
+    friend class Suite;
+
+    size_t iterations = 0;
+    size_t items      = 0;
+    size_t bytes      = 0;
+    double seconds    = 0;
+};
+
+class Suite {
+public:
+    // Only benchmarks whose name contains filter run; each for at least minTime seconds.
+    Suite(std::string filter = "", double minTime = 0.2) : filter(std::move(filter)), minTime(minTime) {}
+
+    void add(std::string name, std::function<void(Run&)> f) {
+        if (name.find(filter) == std::string::npos)
+            return;
+        Run r;
+        while (r.seconds < minTime)
+            f(r);
+        results.push_back({std::move(name), r});
+        auto& res = results.back();
+        std::fprintf(stderr, "%-48s %12.1f ns/item", res.name.c_str(), r.seconds * 1e9 / std::max<size_t>(1, r.items));
+        if (r.bytes)
+            std::fprintf(stderr, " %10.2f MB/s", r.bytes / r.seconds / 1e6);
+        std::fprintf(stderr, "\n");
+    }
+
+    void write_json(std::FILE* out) {
+        char        date[32];
+        std::time_t now = std::time(nullptr);
+        std::strftime(date, sizeof(date), "%FT%T%z", std::localtime(&now));
+        std::fprintf(out, "{\n  \"context\": {\n    \"date\": \"%s\",\n    \"num_cpus\": %u,\n"
+                          "    \"library_build_type\": \"%s\"\n  },\n  \"benchmarks\": [",
+                     date, std::thread::hardware_concurrency(), BUILD_TYPE);
+        for (size_t i = 0; i < results.size(); ++i) {
+            auto& [name, r] = results[i];
+            std::fprintf(out, "%s\n    {\n      \"name\": \"%s\",\n      \"run_type\": \"iteration\",\n"
+                              "      \"iterations\": %zu,\n      \"real_time\": %.3f,\n      \"time_unit\": \"ns\",\n"
+                              "      \"items_per_second\": %.1f",
+                         i ? "," : "", name.c_str(), r.iterations, r.seconds * 1e9 / r.iterations, r.items / r.seconds);
+            if (r.bytes)
+                std::fprintf(out, ",\n      \"bytes_per_second\": %.1f", r.bytes / r.seconds);
+            std::fprintf(out, "\n    }");
+        }
+        std::fprintf(out, "\n  ]\n}\n");
+    }
+
+private:
+#ifdef NDEBUG
+    static constexpr const char* BUILD_TYPE = "release";
+#else
+    static constexpr const char* BUILD_TYPE = "debug";
+#endif
+
+    struct Result {
+        std::string name;
+        Run         run;
+    };
+    std::string         filter;
+    double              minTime;
+    std::vector<Result> results;
+};
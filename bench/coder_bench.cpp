@@ -0,0 +1,269 @@
+// Coder Benchmarks
+// MIT License. Copyright 2023 Mirko Palmer (derbroti)
+////////
+
+#include <cstring>
+#include <random>
+#include "../cpu.h"
+#include "../test/program.h"
+#include "bench.h"
+
+static constexpr size_t N = 1 << 16; // entries per coder iteration
+
+enum clk_t { small_clk, huge_clk };
+enum addr_t { clustered, scattered };
+
+static const char* name(clk_t c) {
+    return c == small_clk ? "small_clk" : "huge_clk";
+}
+static const char* name(addr_t a) {
+    return a == clustered ? "clustered" : "scattered";
+}
+
+static volatile uint64_t sink; // keeps the decoded values alive
+
+// Small clk deltas are a few cycles between writes, huge ones span long idle phases.
+// Clustered addrs stay within a 256 word region for a while (arrays, stack), scattered ones are
+// spread over 24 bit. Values are small deltas.
+static std::vector<MemEntry> mem_input(clk_t c, addr_t a) {
+    std::mt19937_64       rng(42);
+    std::vector<MemEntry> in;
+    uint32_t              region = 0;
+    for (size_t i = 0; i < N; ++i) {
+        if (i % 64 == 0)
+            region = rng() & 0xFFFF00;
+        uint64_t clk  = c == small_clk ? rng() % 4 : rng() >> 24;
+        uint32_t addr = a == clustered ? region | (rng() & 0xFF) : rng() & 0xFFFFFF;
+        in.push_back({clk, addr, (uint16_t)(rng() % 32 - 16)});
+    }
+    return in;
+}
+
+// 16 bit: single register entries, 32 bit: register pairs
+static std::vector<RegEntry> reg_input(clk_t c, bool wide) {
+    std::mt19937_64       rng(42);
+    std::vector<RegEntry> in;
+    for (size_t i = 0; i < N; ++i) {
+        uint64_t clk = c == small_clk ? rng() % 4 : rng() >> 24;
+        uint8_t  idx = wide ? rng() % 8 * 2 : rng() % 16;
+        in.push_back({clk, idx, 0, (uint16_t)rng(), (uint16_t)(wide ? rng() : 0), wide});
+    }
+    return in;
+}
+
+template <Coder::destr_t U, Coder::dir_t V, unsigned ADDR_BITS>
+static void decode(MemCoder& mc) {
+    uint64_t clk  = 0;
+    uint32_t addr = 0;
+    uint16_t val  = 0;
+    uint64_t sum  = 0;
+    for (size_t i = 0; i < N; ++i) {
+        mc.decode<U, V, ADDR_BITS>(clk, addr, val);
+        sum += clk + addr + val;
+    }
+    sink = sum;
+}
+template <Coder::destr_t U, Coder::dir_t V, unsigned>
+static void decode(RegCoder& rc) {
+    uint64_t clk  = 0;
+    uint16_t high = 0, low = 0;
+    uint8_t  idx1 = 0, idx2 = 0;
+    uint64_t sum  = 0;
+    for (size_t i = 0; i < N; ++i) {
+        rc.decode<U, V>(clk, idx2, high, idx1, low);
+        sum += clk + idx1 + low + high;
+    }
+    sink = sum;
+}
+
+// encode, and decode in both directions, destructive and not; MemCoder with addrs bounded to ADDR_BITS
+template <typename C, unsigned ADDR_BITS = 32, typename E>
+static void coder_benches(Suite& s, const std::string& prefix, const std::vector<E>& in) {
+    auto fill = [&](C& c) {
+        for (auto& e : in) {
+            if constexpr (std::is_same_v<C, MemCoder>)
+                c.template encode<ADDR_BITS>(e.clk, e.addr, e.val);
+            else if (e.two_regs)
+                c.encode(e.clk, e.idx1, e.high_value, e.low_value);
+            else
+                c.encode(e.clk, e.idx1, e.low_value);
+        }
+    };
+    C ref;
+    fill(ref);
+    size_t bytes = ref.get_size();
+
+    s.add(prefix + "/encode", [&](Run& r) {
+        C c;
+        r.measure(N, bytes, [&] { fill(c); });
+    });
+    s.add(prefix + "/decode_l2r", [&](Run& r) {
+        ref.reset_iter(Coder::l2r);
+        r.measure(N, bytes, [&] { decode<Coder::non_destr, Coder::l2r, ADDR_BITS>(ref); });
+    });
+    s.add(prefix + "/decode_r2l", [&](Run& r) {
+        ref.reset_iter(Coder::r2l);
+        r.measure(N, bytes, [&] { decode<Coder::non_destr, Coder::r2l, ADDR_BITS>(ref); });
+    });
+    s.add(prefix + "/decode_destr_l2r", [&](Run& r) {
+        C c;
+        fill(c);
+        c.reset_iter(Coder::l2r);
+        r.measure(N, bytes, [&] { decode<Coder::destr, Coder::l2r, ADDR_BITS>(c); });
+    });
+    s.add(prefix + "/decode_destr_r2l", [&](Run& r) {
+        C c;
+        fill(c);
+        c.reset_iter(Coder::r2l);
+        r.measure(N, bytes, [&] { decode<Coder::destr, Coder::r2l, ADDR_BITS>(c); });
+    });
+}
+
+// Register writes and register pair loads in every word of a 4096 word memory: pc wraps around,
+// so it loops over the whole memory, never writing to it
+template <typename Cpu>
+static void load_loop(Cpu& c) {
+    for (uint32_t a = 0; a < 4096; a += 2)
+        c.set_inst(a, (a % 6 == 0 ? 0x2 << 28 : 0x1 << 28) | ((a * 91 + 7) & 0x1F) << 16 | 0x1000 | ((a * 37 + 100) & 0xFFF));
+    c.clk = 1;
+}
+
+static constexpr size_t STEPS = 10000;
+
+template <typename Cpu>
+static void step_bench(Run& r, Cpu& c) {
+    r.measure(STEPS, 0, [&] {
+        for (size_t i = 0; i < STEPS; ++i)
+            c.step();
+    });
+}
+template <typename Cpu>
+static void run_bench(Run& r, Cpu& c) {
+    r.measure(STEPS, 0, [&] { c.step(STEPS); });
+}
+
+int main(int argc, char** argv) {
+    std::string filter, out;
+    double      minTime = 0.2;
+    for (int i = 1; i < argc; ++i) {
+        if (! std::strncmp(argv[i], "--filter=", 9))
+            filter = argv[i] + 9;
+        else if (! std::strncmp(argv[i], "--min-time=", 11))
+            minTime = std::atof(argv[i] + 11);
+        else if (! std::strncmp(argv[i], "--out=", 6))
+            out = argv[i] + 6;
+        else if (! std::strcmp(argv[i], "--kernel=scalar"))
+            Coder::set_kernel(Coder::scalar);
+        else if (! std::strcmp(argv[i], "--kernel=swar"))
+            Coder::set_kernel(Coder::swar);
+        else if (! std::strcmp(argv[i], "--kernel=bmi2"))
+            Coder::set_kernel(Coder::bmi2);
+        else {
+            std::fprintf(stderr, "usage: %s [--filter=substr] [--min-time=seconds] [--out=file.json] [--kernel=scalar|swar|bmi2]\n", argv[0]);
+            return 1;
+        }
+    }
+    Suite s(filter, minTime);
+
+    for (clk_t c : {small_clk, huge_clk}) {
+        for (addr_t a : {clustered, scattered}) {
+            auto in = mem_input(c, a);
+            coder_benches<MemCoder>(s, std::string("MemCoder/") + name(c) + "/" + name(a), in);
+            coder_benches<MemCoder, 24>(s, std::string("MemCoder/") + name(c) + "/" + name(a) + "/addr24", in);
+        }
+        for (bool wide : {false, true})
+            coder_benches<RegCoder>(s, std::string("RegCoder/") + name(c) + (wide ? "/32bit" : "/16bit"), reg_input(c, wide));
+    }
+
+    {
+        Cpu_t<16, false>              plain(0);
+        Cpu_t<16, false, false, true> predecoded(1);
+        load_program(plain, regs);
+        load_program(predecoded, regs);
+        s.add("Cpu_t/step", [&](Run& r) { step_bench(r, plain); });
+        s.add("Cpu_t/step_predecoded", [&](Run& r) { step_bench(r, predecoded); });
+
+        Cpu_t<11, false>              loop(0);
+        Cpu_t<11, false, false, true> predecodedLoop(1);
+        load_loop(loop);
+        load_loop(predecodedLoop);
+        s.add("Cpu_t/run/loop", [&](Run& r) { run_bench(r, loop); });
+        s.add("Cpu_t/run_predecoded/loop", [&](Run& r) { run_bench(r, predecodedLoop); });
+        s.add("Cpu_t/run/program", [&](Run& r) { run_bench(r, plain); });
+        s.add("Cpu_t/run_predecoded/program", [&](Run& r) { run_bench(r, predecoded); });
+
+        Cpu_t<16, true>       tracked(0), async(1);
+        Cpu_t<16, true, true> instrumented(2);
+        for (auto* c : {&tracked, &async}) {
+            load_program(*c, regs);
+            c->set_checkpoint_interval(1000);
+            c->set_log_budget(16 << 20);
+        }
+        Cpu_t<11, true>              trackedLoop(0);
+        Cpu_t<11, true, false, true> trackedPredecodedLoop(1);
+        auto prepare = [](auto& c) {
+            load_loop(c);
+            c.set_checkpoint_interval(1000);
+            c.set_log_budget(16 << 20);
+        };
+        prepare(trackedLoop);
+        prepare(trackedPredecodedLoop);
+        load_program(instrumented, regs);
+        instrumented.set_checkpoint_interval(1000);
+        instrumented.set_log_budget(16 << 20);
+        async.set_async_log(true);
+        // no option set: what tracking costs every step by itself (compare with Cpu_t/step)
+        Cpu_t<16, true> plainTracked(3);
+        load_program(plainTracked, regs);
+        s.add("Cpu_t/step_tracking/plain", [&](Run& r) { step_bench(r, plainTracked); });
+        s.add("Cpu_t/step_tracking", [&](Run& r) { step_bench(r, tracked); });
+        s.add("Cpu_t/step_tracking_async", [&](Run& r) { step_bench(r, async); });
+        s.add("Cpu_t/step_tracking_instrumented", [&](Run& r) { step_bench(r, instrumented); });
+        s.add("Cpu_t/run_tracking/loop", [&](Run& r) { run_bench(r, trackedLoop); });
+        s.add("Cpu_t/run_tracking_predecoded/loop", [&](Run& r) { run_bench(r, trackedPredecodedLoop); });
+    }
+
+    {
+        Cpu_t<16, true> c(0);
+        load_program(c, regs);
+        c.set_checkpoint_interval(1000);
+        for (size_t i = 0; i < 200000; ++i)
+            c.step();
+        uint64_t end = c.clk;
+        for (uint64_t d : {1, 123, 12345, 123456}) {
+            s.add("Cpu_t/sync_back/" + std::to_string(d), [&](Run& r) {
+                r.measure(1, 0, [&] { c.sync(end - d); });
+                c.sync(end);
+            });
+            s.add("Cpu_t/sync_forward/" + std::to_string(d), [&](Run& r) {
+                c.sync(end - d);
+                r.measure(1, 0, [&] { c.sync(end); });
+            });
+        }
+
+        // no checkpoints, per cycle: the whole log is undone and redone
+        Cpu_t<16, true> plain(1);
+        load_program(plain, regs);
+        plain.step(200000);
+        uint64_t plainEnd = plain.clk;
+        s.add("Cpu_t/sync_back/all", [&](Run& r) {
+            r.measure(plainEnd - 1, 0, [&] { plain.sync(1); });
+            plain.sync(plainEnd);
+        });
+        s.add("Cpu_t/sync_forward/all", [&](Run& r) {
+            plain.sync(1);
+            r.measure(plainEnd - 1, 0, [&] { plain.sync(plainEnd); });
+        });
+    }
+
+    if (out.empty()) {
+        s.write_json(stdout);
+    } else if (std::FILE* f = std::fopen(out.c_str(), "w")) {
+        s.write_json(f);
+        std::fclose(f);
+    } else {
+        std::perror(out.c_str());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,145 @@
+// Block
+// MIT License. Copyright 2023 Mirko Palmer (derbroti)
+////////
+
+// Self-contained LZ77 block codec (LZ4 style) for sealed coder chunks.
+//
+// A block is a series of sequences:
+//
+// |---- 1 byte ----|----- n byte -----|-- literals --|-- 2 byte --|------ n byte ------|
+// 4bit literal len, (literal len - 15),   literals,     offset,     (match len - 4 - 15)
+// 4bit match len-4   as 255-runs                                     as 255-runs
+//
+// The last sequence ends after its literals. Matches are at least 4 bytes long and may overlap
+// their own output (offset < length), which is what repeating clk/addr/value runs turn into.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <vector>
+
+class Block {
+public:
+    static constexpr size_t MIN_MATCH = 4;
+
+    // Compress in, appending to out
+    static void pack(std::span<const uint8_t> in, std::vector<uint8_t>& out) {
+        const uint8_t* p     = in.data();
+        const uint8_t* end   = p + in.size();
+        const uint8_t* lit   = p;
+        const uint8_t* limit = in.size() >= MIN_MATCH ? end - MIN_MATCH : p;
+        std::vector<uint32_t> table(1 << HASH_BITS, 0); // position + 1 of the last 4 byte run with that hash
+
+        out.reserve(out.size() + in.size() + in.size() / 255 + 16);
+        while (p < limit) {
+            uint32_t h    = hash(load32(p));
+            uint32_t cand = table[h];
+            table[h]      = (uint32_t)(p - in.data()) + 1;
+
+            const uint8_t* m = cand ? in.data() + (cand - 1) : nullptr;
+            if (! m || (size_t)(p - m) > MAX_OFFSET || load32(m) != load32(p)) {
+                ++p;
+                continue;
+            }
+            const uint8_t* q = p + MIN_MATCH;
+            while (q < end && *q == m[q - p])
+                ++q;
+            put_sequence(out, lit, p - lit, p - m, q - p);
+            p = lit = q;
+        }
+        put_sequence(out, lit, end - lit, 0, 0);
+    }
+
+    // Decompress in into exactly n bytes at out; false for malformed input.
+    static bool unpack(std::span<const uint8_t> in, uint8_t* out, size_t n) {
+        const uint8_t* p   = in.data();
+        const uint8_t* end = p + in.size();
+        uint8_t*       o   = out;
+        uint8_t*       oe  = out + n;
+
+        while (p < end) {
+            uint8_t token = *p++;
+            size_t  len   = token >> 4;
+            if (! get_len(p, end, len) || (size_t)(end - p) < len || (size_t)(oe - o) < len)
+                return false;
+            std::copy_n(p, len, o);
+            p += len;
+            o += len;
+            if (p == end)
+                break;
+
+            if (end - p < 2)
+                return false;
+            size_t offs = p[0] | p[1] << 8;
+            p          += 2;
+            len         = token & 0xF;
+            if (! get_len(p, end, len))
+                return false;
+            len += MIN_MATCH;
+            if (offs == 0 || offs > (size_t)(o - out) || (size_t)(oe - o) < len)
+                return false;
+
+            const uint8_t* m = o - offs;
+            if (offs >= 8 && (size_t)(oe - o) >= len + 8) {
+                // non-overlapping in 8 byte steps, may overshoot into space the next sequence writes
+                uint8_t* e = o + len;
+                for (; o < e; o += 8, m += 8)
+                    std::memcpy(o, m, 8);
+                o = e;
+            } else {
+                for (size_t i = 0; i < len; ++i)
+                    *o++ = *m++;
+            }
+        }
+        return o == oe;
+    }
+
+private:
+    static constexpr uint32_t HASH_BITS  = 12;
+    static constexpr size_t   MAX_OFFSET = 0xFFFF;
+
+    static uint32_t load32(const uint8_t* p) {
+        uint32_t w;
+        std::memcpy(&w, p, sizeof(w));
+        return w;
+    }
+    static uint32_t hash(uint32_t w) {
+        return (w * 2654435761u) >> (32 - HASH_BITS);
+    }
+
+    static void put_len(std::vector<uint8_t>& out, size_t len) {
+        for (; len >= 255; len -= 255)
+            out.push_back(255);
+        out.push_back((uint8_t)len);
+    }
+    static bool get_len(const uint8_t*& p, const uint8_t* end, size_t& len) {
+        if (len != 15)
+            return true;
+        uint8_t b;
+        do {
+            if (p == end)
+                return false;
+            b    = *p++;
+            len += b;
+        } while (b == 255);
+        return true;
+    }
+
+    static void put_sequence(std::vector<uint8_t>& out, const uint8_t* lit, size_t litLen, size_t offs, size_t matchLen) {
+        size_t m = matchLen ? matchLen - MIN_MATCH : 0;
+        out.push_back((uint8_t)(std::min<size_t>(litLen, 15) << 4 | std::min<size_t>(m, 15)));
+        if (litLen >= 15)
+            put_len(out, litLen - 15);
+        out.insert(out.end(), lit, lit + litLen);
+        if (! matchLen)
+            return;
+        out.push_back(offs & 0xFF);
+        out.push_back(offs >> 8);
+        if (m >= 15)
+            put_len(out, m - 15);
+    }
+};
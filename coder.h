@@ -50,9 +50,30 @@
 //
 //
 
+#pragma once
+
 #include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <deque>
+#include <functional>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "block.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define CODER_BMI2
+#endif
 
 using std::cout, std::endl;
 
@@ -62,44 +83,447 @@ class Coder {
 public:
     enum dir_t { l2r, r2l };
     enum destr_t { non_destr, destr };
+    enum kernel_t { scalar, swar, bmi2 }; // varint kernels, see best_kernel()
+
+    // An entry boundary within the stream, see tell() for offsets.
+    struct Pos {
+        size_t   offset;
+        size_t   ordinal; // number of entries in front of it, consumed ones included
+        uint64_t clk;     // absolute clk of the entry in front of it: sum of all clk fields up to here
+        uint32_t addr;    // MemCoder: addr of the entry in front of it (context of the delta modes)
+        uint32_t reserved = 0; // fills the tail padding: Pos is written out as is (trace files, live rings)
+    };
+
+    // Encoded bytes live in fixed size, contiguous chunks.
+    // An entry never straddles two chunks (see reserve()), so each chunk decodes on its own.
+    // Attached chunks (see attach()) reference read-only bytes owned by someone else.
+    struct Chunk {
+        std::shared_ptr<uint8_t[]> mem;
+        uint8_t* head; // first live byte
+        uint8_t* tail; // one past the last live byte
+        uint8_t* cap;  // end of the writable area
+        size_t   base; // stream offset of the first writable byte
+        size_t   seq;
+        Pos      from; // position of the first entry written to it
+        bool     attached = false;
+
+        std::vector<uint8_t> packed = {}; // the live bytes while compressed (see freeze())
+        size_t               frozen = 0;  // their number then, 0 while mem holds them
+    };
+
+    // Read-only cursor over the live entries of a D coder (entries as its decode_batch() yields
+    // them), independent of the coder's own cursors: any number of them may walk one coder at once,
+    // as long as no entries are added or dropped meanwhile. Compressed chunks get unpacked into a
+    // buffer the copies of an iterator share, instead of being thawed; the current chunk's bytes
+    // are kept alive should the coder compress it meanwhile. Models std::bidirectional_iterator.
+    template <typename D, typename E>
+    class Iterator {
+    public:
+        using value_type      = E;
+        using difference_type = std::ptrdiff_t;
+
+        Iterator() = default;
+        // At the entry boundary pos (see resync_points())
+        Iterator(const D* coder, Pos pos) : coder(coder), at(pos) {
+            auto& chunks = coder->chunks;
+            auto  it     = std::ranges::upper_bound(chunks, pos.offset, {}, &Chunk::base);
+            if (it != chunks.begin())
+                --it;
+            load(it - chunks.begin());
+            p = head + (pos.offset - std::min(pos.offset, head_offset(*it)));
+            settle();
+        }
+
+        // By value: a reference into the iterator would dangle in std::reverse_iterator
+        E operator*() const {
+            return cur;
+        }
+        Iterator& operator++() {
+            at = {at.offset + (next - p), at.ordinal + 1, at.clk + cur.clk, nextAddr};
+            p  = next;
+            settle();
+            return *this;
+        }
+        Iterator operator++(int) {
+            Iterator it = *this;
+            ++*this;
+            return it;
+        }
+        Iterator& operator--() {
+            if (p == head) {
+                load(chunk - 1);
+                p = tail;
+            }
+            next     = p;
+            nextAddr = at.addr;
+            p        = coder->rget_entry(p, head, cur, at.addr);
+            at       = {at.offset - (next - p), at.ordinal - 1, at.clk - cur.clk, at.addr};
+            return *this;
+        }
+        Iterator operator--(int) {
+            Iterator it = *this;
+            --*this;
+            return it;
+        }
+        bool operator==(const Iterator& o) const {
+            return at.offset == o.at.offset;
+        }
+
+        // The entry boundary in front of the current entry (absolute clk)
+        Pos pos() const {
+            return at;
+        }
+
+    private:
+        const D* coder = nullptr;
+        size_t   chunk = 0; // index in chunks
+        uint8_t* head  = nullptr;
+        uint8_t* tail  = nullptr;
+        uint8_t* p     = nullptr; // the current entry ...
+        uint8_t* next  = nullptr; // ... and the one behind it
+        E        cur{};
+        uint32_t nextAddr = 0; // Pos::addr at next
+        Pos      at{};
+
+        std::shared_ptr<std::vector<uint8_t>> buf; // the current chunk unpacked, if compressed
+        std::shared_ptr<uint8_t[]>            mem; // its bytes otherwise, should it get compressed meanwhile
+
+        void load(size_t i) {
+            const Chunk& c = coder->chunks[i];
+            chunk          = i;
+            head     = c.head;
+            mem      = c.mem;
+            buf.reset();
+            if (c.frozen) {
+                buf  = std::make_shared<std::vector<uint8_t>>(c.frozen + 2 * PADDING);
+                head = buf->data() + PADDING;
+                Block::unpack(c.packed, head, c.frozen);
+            }
+            tail = head + live(c);
+        }
+        // Skip to the next chunk's head from a chunk's tail (the last chunk's tail is the end),
+        // and decode the current entry.
+        void settle() {
+            while (p == tail && chunk + 1 < coder->chunks.size()) {
+                load(chunk + 1);
+                p = head;
+            }
+            if (p != tail) {
+                nextAddr = at.addr;
+                next     = coder->get_entry(p, tail, cur, nextAddr);
+            }
+        }
+    };
+
+    // A chunk as a self-contained run of whole entries
+    struct Segment {
+        Pos  from;
+        Pos  to;
+        bool attached;
+        bool compressed;
+    };
+
+    // What happens to the oldest chunks once the owned ones exceed the memory budget
+    enum evict_t { drop, spill, compress };
+
+    // Chunks compressed by the compress policy, and their decompression on demand
+    struct BlockStats {
+        size_t blocks   = 0; // compressed so far
+        size_t raw      = 0; // their bytes before ...
+        size_t packed   = 0; // ... and after compression
+        size_t thawed   = 0; // bytes decompressed again
+        double seconds  = 0; // time spent decompressing
 
-    Coder(): s_it(s.begin()), s_rit(s.rbegin()) {}
+        double ratio() const {
+            return packed ? (double)raw / packed : 0;
+        }
+        double throughput() const { // MB/s
+            return seconds > 0 ? thawed / seconds / 1e6 : 0;
+        }
+    };
+
+    static constexpr size_t CHUNK_SIZE  = 64 * 1024;
+    static constexpr size_t INDEX_EVERY = 64;
+    static constexpr size_t PADDING     = 16; // slack around the writable area, so word accesses may overshoot
+
+    template <typename U>
+    static constexpr size_t max_len = (sizeof(U) * 8 + 6) / 7;
+    // Encoded length of value
+    static constexpr uint8_t varint_len(uint64_t value) {
+        return (std::bit_width(value | 1) + 6) / 7;
+    }
+
+    // The word-at-a-time kernels handle varints of up to 8 byte (values < 2^56) and need a
+    // little-endian host; longer varints always take the scalar loop. The best kernel the host
+    // supports, for set_kernel(): the default stays scalar, the word kernels decode one field per
+    // call and have not beaten the byte loop in bench/coder_bench (--kernel=...).
+    static kernel_t best_kernel() {
+        if constexpr (std::endian::native != std::endian::little)
+            return scalar;
+#ifdef CODER_BMI2
+        if (__builtin_cpu_supports("bmi2"))
+            return bmi2;
+#endif
+        return swar;
+    }
+    static void set_kernel(kernel_t k) {
+        kernel = std::min(k, best_kernel());
+    }
+    static kernel_t get_kernel() {
+        return kernel;
+    }
+
+    Coder(size_t chunk_size = CHUNK_SIZE): chunk_size(chunk_size) {
+        new_chunk(0);
+        reset_iter();
+    }
+    Coder(const Coder&)            = delete;
+    Coder& operator=(const Coder&) = delete;
+    Coder(Coder&&)                 = default;
+    Coder& operator=(Coder&&)      = default;
 
     void reset_iter(dir_t dir) {
-        if (dir == l2r)
-            s_it = s.begin();
-        else
-            s_rit = s.rbegin();
+        if (dir == l2r) {
+            Chunk* c = thaw(&chunks.front());
+            s_it     = {c->head, c, frontAddr};
+        } else {
+            s_rit = {chunks.back().tail, &chunks.back(), backAddr};
+        }
     }
     void reset_iter() {
         reset_iter(l2r);
         reset_iter(r2l);
     }
 
-    bool print(std::deque<uint8_t> cmp = {}, bool silent = false) {
+    // Stream offsets count every byte ever written in front of a position, consumed ones included.
+    // They stay valid across destructive decodes, as long as that position itself is still alive.
+    size_t tell(dir_t dir) {
+        Cursor& it = dir == l2r ? s_it : s_rit;
+        return offset(it);
+    }
+    size_t begin_offset() const {
+        return head_offset(chunks.front());
+    }
+    size_t end_offset() const {
+        return chunks.back().base + (chunks.back().tail - start(chunks.back()));
+    }
+
+    // Move a cursor to an entry boundary, clamped to the live bytes.
+    void seek(dir_t dir, size_t offs) {
+        auto it = std::ranges::upper_bound(chunks, offs, {}, &Chunk::base);
+        if (it != chunks.begin())
+            --it;
+        Chunk*   c = thaw(&*it);
+        uint8_t* p = start(*c) + std::min(offs - std::min(offs, c->base), (size_t)(c->tail - start(*c)));
+        p          = std::max(p, c->head);
+        Cursor& cur = dir == l2r ? s_it : s_rit;
+        cur.p       = p;
+        cur.c       = c;
+    }
+    // Same, to a known entry boundary
+    void seek(dir_t dir, Pos pos) {
+        seek(dir, pos.offset);
+        (dir == l2r ? s_it : s_rit).addr = pos.addr;
+    }
+
+    // Drop everything from offs (an entry boundary) to the end of the stream.
+    void truncate(size_t offs) {
+        seek(r2l, offs);
+        consume<r2l>();
+    }
+    // Drop the oldest chunks that lie entirely in front of offs (an entry boundary), the last one stays.
+    void drop_before(size_t offs) {
+        while (chunks.size() > 1 && head_offset(chunks[1]) <= offs)
+            drop_oldest();
+    }
+
+    // The clk index keeps a Pos every so many encoded entries (applies to entries encoded from now on).
+    void set_index_interval(size_t entries) {
+        every = std::max<size_t>(1, entries);
+    }
+    Pos front_pos() const {
+        return {begin_offset(), frontOrd, frontClk, frontAddr};
+    }
+    Pos back_pos() const {
+        return {end_offset(), backOrd, backClk, backAddr};
+    }
+
+    // Entry boundaries decoding can start at without reading anything in front of them: the clk
+    // index marks (one every set_index_interval() entries), framed by front_pos() and back_pos().
+    // Traces store the marks next to each segment, so they survive a save and load.
+    std::vector<Pos> resync_points() {
+        std::vector<Pos> pts{front_pos()};
+        for (auto& m : marks) {
+            if (m.offset > pts.back().offset && m.offset < end_offset())
+                pts.push_back(m);
+        }
+        if (end_offset() > pts.back().offset)
+            pts.push_back(back_pos());
+        return pts;
+    }
+
+    std::vector<uint8_t> dump() {
+        std::vector<uint8_t> bytes;
+        bytes.reserve(live_bytes);
+        for (auto& c : chunks) {
+            if (c.frozen) {
+                bytes.resize(bytes.size() + c.frozen);
+                Block::unpack(c.packed, bytes.data() + bytes.size() - c.frozen, c.frozen);
+            } else {
+                bytes.insert(bytes.end(), c.head, c.tail);
+            }
+        }
+        return bytes;
+    }
+
+    bool print(std::vector<uint8_t> cmp = {}, bool silent = false) {
+        auto bytes = dump();
         if (! silent) {
             cout << std::hex;
-            std::ranges::copy(s, std::ostream_iterator<int>(std::cout, " "));
+            std::ranges::copy(bytes, std::ostream_iterator<int>(std::cout, " "));
             cout << std::dec << endl;
         }
-        return cmp.empty() || s == cmp; // don't compare if cmp is not set
+        return cmp.empty() || bytes == cmp; // don't compare if cmp is not set
     }
 
     size_t get_size() {
-        return s.size();
+        return live_bytes;
+    }
+    size_t num_elements() const {
+        return elements;
+    }
+    // Field modes of derived coders (see MemCoder::mode_t)
+    uint8_t get_mode() const {
+        return mode;
+    }
+
+    // Live entries chunk by chunk, oldest first
+    std::vector<Segment> segments() {
+        std::vector<Segment> segs;
+        for (auto& c : chunks) {
+            if (live(c) == 0)
+                continue;
+            Pos from = &c == &chunks.front() ? front_pos() : c.from;
+            Pos to   = &c == &chunks.back() ? back_pos() : next(&c)->from;
+            segs.push_back({from, to, c.attached, c.frozen > 0});
+        }
+        return segs;
+    }
+
+    // Bytes held by owned (not attached) and compressed chunks
+    size_t memory_usage() const {
+        size_t used = 0;
+        for (auto& c : chunks)
+            used += owned(c);
+        return used;
+    }
+
+    BlockStats block_stats() {
+        return blockStats;
+    }
+
+    // Whenever a new chunk is started and the owned chunks exceed bytes (0 := unlimited), the
+    // oldest ones get evicted: dropped (as if decoded destructively l2r), handed to spiller,
+    // which swaps them for read-only copies (see Trace::spill_from()), or compressed (see block.h).
+    // Compressed chunks get decompressed again as soon as a cursor, seek or index walk enters them,
+    // the chunks the cursors are in stay uncompressed.
+    void set_memory_budget(size_t bytes, evict_t policy = drop) {
+        budget = bytes;
+        evict  = policy;
+        over   = false;
+    }
+    std::function<bool(Chunk&)> spiller;
+
+    // Evict the oldest chunks while the owned ones exceed the budget; the last one always stays.
+    // Runs whenever a new chunk is started; call it after long reads to compress chunks again.
+    // False if they still exceed it: the spiller failed, or nothing was left to evict.
+    bool enforce_budget() {
+        if (! budget)
+            return true;
+        size_t used = memory_usage();
+        while (used > budget && chunks.size() > 1) {
+            if (evict == drop) {
+                used -= owned(chunks.front());
+                drop_oldest();
+            } else if (evict == spill) {
+                auto   c     = std::ranges::find(chunks, false, &Chunk::attached);
+                size_t freed = owned(*c);
+                if (&*c == &chunks.back() || ! spiller || ! spiller(*c))
+                    break;
+                used -= freed;
+            } else {
+                auto c = std::ranges::find_if(chunks, [this](Chunk& c) { return can_freeze(c); });
+                if (c == chunks.end())
+                    break;
+                used -= owned(*c);
+                freeze(*c);
+                used += owned(*c);
+            }
+        }
+        over = used > budget;
+        return ! over;
+    }
+    // False while the last enforce_budget() left the owned chunks over the budget, e.g. a spill failed
+    bool within_budget() const {
+        return ! over;
+    }
+
+    // Make room for n bytes in the last chunk; call once per entry with its maximum encoded size.
+    // Returns that chunk: hold on to it while writing, chunks.back() is no plain load, and the
+    // compiler has to redo it after every byte stored.
+    Chunk& reserve(size_t n) {
+        Chunk* c = &chunks.back();
+        if (c->attached || (size_t)(c->cap - c->tail) < n) {
+            new_chunk(std::max(n, chunk_size));
+            c = &chunks.back();
+        }
+        return *c;
+    }
+
+    // Append the n bytes at data, whole entries spanning from..to in stream terms, as a read-only
+    // chunk without copying them. idx are clk index marks within them. PADDING bytes around data
+    // have to be readable, keep holds the storage alive.
+    // An empty coder takes over from's offset, ordinal and clk, otherwise from has to be back_pos().
+    // Resets both iterators.
+    bool attach(const uint8_t* data, Pos from, Pos to, std::span<const Pos> idx, std::shared_ptr<const void> keep) {
+        if (live_bytes == 0) {
+            marks.clear();
+            elements = 0;
+            frontOrd = backOrd = from.ordinal;
+            frontClk = backClk = from.clk;
+            frontAddr = backAddr = from.addr;
+        } else if (from.offset != end_offset() || from.ordinal != backOrd || from.clk != backClk) {
+            return false;
+        }
+        if (chunks.back().head == chunks.back().tail)
+            chunks.pop_back();
+
+        size_t   n   = to.offset - from.offset;
+        size_t   seq = chunks.empty() ? 0 : chunks.back().seq + 1;
+        uint8_t* p   = const_cast<uint8_t*>(data);
+        std::shared_ptr<uint8_t[]> mem(keep, p - PADDING);
+        chunks.push_back({std::move(mem), p, p + n, p + n, from.offset, seq, from, true});
+
+        marks.insert(marks.end(), idx.begin(), idx.end());
+        live_bytes += n;
+        elements   += to.ordinal - from.ordinal;
+        backOrd     = to.ordinal;
+        backClk     = to.clk;
+        backAddr    = to.addr;
+        untilMark   = 0;
+        reset_iter();
+        return true;
     }
 
     template <typename U>
     void _encode(U value) {
-        do {
-            s.push_back(value & trim);
-            value >>= 7;
-        } while (value != 0);
-        s.back() |= mark;
+        Chunk& c = reserve(max_len<U>);
+        commit(c, put(c.tail, value));
     }
 
     void _encode_raw(uint8_t val) {
-        s.push_back(val);
+        *reserve(1).tail++ = val;
+        ++live_bytes;
     }
 
     template <destr_t U, dir_t V, typename W>
@@ -107,116 +531,894 @@ public:
         if (! is_valid<V>())
             return;
 
-        if constexpr (V == l2r) {
-            uint8_t cnt = 0;
-            value       = 0;
+        if constexpr (V == l2r)
+            s_it.p = get(s_it.p, s_it.c->tail, value);
+        else
+            s_rit.p = rget(s_rit.p, s_rit.c->head, value);
+
+        if constexpr (U == destr)
+            consume<V>();
+    }
+
+    template <destr_t U, dir_t V>
+    void _decode_raw(uint8_t& val) {
+        if (! is_valid<V>())
+            return;
+
+        if constexpr (V == Coder::l2r)
+            val = *s_it.p++;
+        else
+            val = *--s_rit.p;
+
+        if constexpr (U == destr)
+            consume<V>();
+    }
+
+protected:
+    // l2r: p is the next byte to read; r2l: p is one past the next byte to read
+    struct Cursor {
+        uint8_t* p;
+        Chunk*   c;
+        uint32_t addr = 0; // Pos::addr at p, kept by MemCoder
+    };
+
+    static constexpr uint8_t mark = 0x80;
+    static constexpr uint8_t trim = 0x7F;
+
+    Cursor s_it;
+    Cursor s_rit;
+
+    size_t  elements = 0;
+    uint8_t mode     = 0;
+
+    // Sparse clk index, sorted by offset (and thereby by ordinal and clk)
+    std::deque<Pos> marks;
+    size_t          every     = INDEX_EVERY;
+    size_t          untilMark = 0;
+    size_t          frontOrd  = 0, backOrd = 0;
+    uint64_t        frontClk  = 0, backClk = 0;
+    uint32_t        frontAddr = 0, backAddr = 0;
+
+    // Call for every entry, right before it gets written to p.
+    void index(uint8_t* p, uint64_t clk) {
+        if (untilMark == 0) {
+            marks.push_back({offset({p, &chunks.back()}), backOrd, backClk, backAddr});
+            untilMark = every;
+        }
+        --untilMark;
+        ++backOrd;
+        backClk += clk;
+    }
 
-            while (! (*s_it & mark)) {
-                value |= ((W)(*s_it & trim) << cnt);
-                cnt   += 7;
-                if (! advance<U, V>(s_it))
+    // Step over whole entries from pos as long as pred() accepts the position behind the next one.
+    // read(p, end, clk, addr) parses the entry at p and returns its end, addr is the Pos::addr
+    // in front of it and gets updated to the one behind it.
+    template <typename R, typename P>
+    Pos walk(Pos pos, R read, P pred) {
+        auto it = std::ranges::upper_bound(chunks, pos.offset, {}, &Chunk::base);
+        if (it != chunks.begin())
+            --it;
+        Chunk*   c = thaw(&*it);
+        uint8_t* p = std::max(start(*c) + (pos.offset - c->base), c->head);
+        for (;;) {
+            if (p == c->tail) {
+                if (! (c = next(c)))
                     break;
+                p = thaw(c)->head;
             }
-            value |= ((W)(*s_it & trim)) << cnt;
-            advance<U, V>(s_it);
+            uint64_t clk;
+            uint32_t addr = pos.addr;
+            uint8_t* q    = read(p, c->tail, clk, addr);
+            Pos      n{pos.offset + (q - p), pos.ordinal + 1, pos.clk + clk, addr};
+            if (! pred(n))
+                break;
+            pos = n;
+            p   = q;
+        }
+        return pos;
+    }
+
+    // Read-only walk over the entries from pos up to the boundary at offset to. Compressed chunks
+    // are unpacked into a local buffer instead of being thawed, so several scans may run at once
+    // (as long as nothing modifies the coder meanwhile).
+    template <typename R>
+    Pos scan(Pos pos, size_t to, R read) {
+        auto it = std::ranges::upper_bound(chunks, pos.offset, {}, &Chunk::base);
+        if (it != chunks.begin())
+            --it;
+        std::vector<uint8_t> buf;
+        for (; it != chunks.end() && pos.offset < to; ++it) {
+            uint8_t* head = it->head;
+            if (it->frozen) {
+                buf.resize(it->frozen + 2 * PADDING);
+                head = buf.data() + PADDING;
+                Block::unpack(it->packed, head, it->frozen);
+            }
+            uint8_t* tail = head + live(*it);
+            uint8_t* p    = head + (pos.offset - std::min(pos.offset, head_offset(*it)));
+            while (p < tail && pos.offset < to) {
+                uint64_t clk;
+                uint32_t addr = pos.addr;
+                uint8_t* q    = read(p, tail, clk, addr);
+                pos = {pos.offset + (q - p), pos.ordinal + 1, pos.clk + clk, addr};
+                p   = q;
+            }
+        }
+        return pos;
+    }
+
+    // The entry boundary at offs
+    template <typename R>
+    Pos locate(size_t offs, R read) {
+        Pos  from = front_pos();
+        auto m    = std::ranges::upper_bound(marks, offs, {}, &Pos::offset);
+        if (m != marks.begin() && std::prev(m)->offset > from.offset)
+            from = *std::prev(m);
+        return walk(from, read, [&](const Pos& n) { return n.offset <= offs; });
+    }
+
+    // The entry boundary in front of the first entry with an absolute clk >= clk
+    template <typename R>
+    Pos find(uint64_t clk, R read) {
+        Pos  from = front_pos();
+        auto m    = std::ranges::lower_bound(marks, clk, {}, &Pos::clk);
+        if (m != marks.begin() && std::prev(m)->offset > from.offset)
+            from = *std::prev(m);
+        return walk(from, read, [&](const Pos& n) { return n.clk < clk; });
+    }
+
+    // Destructive decodes: where the cursor starts (before), and the n entries holding clk
+    // in total it consumed from there, with the cursor's addr context behind them (after)
+    template <dir_t V, typename R>
+    Pos unindex_from(R read) {
+        size_t offs = tell(V);
+        if (offs == (V == l2r ? begin_offset() : end_offset()))
+            return V == l2r ? front_pos() : back_pos();
+        return locate(offs, read);
+    }
+    template <dir_t V>
+    void unindex(Pos from, size_t n, uint64_t clk, uint32_t addr = 0) {
+        if constexpr (V == l2r) {
+            frontOrd  = from.ordinal + n;
+            frontClk  = from.clk + clk;
+            frontAddr = addr;
+            while (! marks.empty() && marks.front().offset < begin_offset())
+                marks.pop_front();
         } else {
-            value = *s_rit & trim;
-            if (! advance<U, V>(s_rit))
-                return;
-
-            while (! (*s_rit & mark)) {
-                value <<= 7;
-                value |= *s_rit;
-                if (! advance<U, V>(s_rit))
+            backOrd  = from.ordinal - n;
+            backClk  = from.clk - clk;
+            backAddr = addr;
+            while (! marks.empty() && marks.back().offset >= end_offset())
+                marks.pop_back();
+            untilMark = marks.empty() ? 0 : every - std::min(every, backOrd - marks.back().ordinal);
+        }
+    }
+
+    // Swap the live bytes of c, which start at from, for an identical read-only copy at data.
+    void replace(Chunk& c, Pos from, const uint8_t* data, std::shared_ptr<const void> keep) {
+        uint8_t* p = const_cast<uint8_t*>(data);
+        for (Cursor* it : {&s_it, &s_rit}) {
+            if (it->c == &c)
+                it->p = p + (offset(*it) - from.offset);
+        }
+        c.mem      = std::shared_ptr<uint8_t[]>(keep, p - PADDING);
+        c.tail     = c.cap = p + (c.tail - c.head);
+        c.head     = p;
+        c.base     = from.offset;
+        c.attached = true;
+    }
+
+    // The bytes written to c (from reserve()) up to p become part of the stream
+    void commit(Chunk& c, uint8_t* p) {
+        live_bytes += p - c.tail;
+        c.tail      = p;
+    }
+
+    // BITS: a known upper bound of the value's width (by default its type's). Bounds of at most 56 bits
+    // take the word kernels unconditionally, and the scalar loops get a fixed trip count.
+    template <unsigned BITS, typename U>
+    static constexpr size_t bound_len = (std::min<unsigned>(BITS, sizeof(U) * 8) + 6) / 7;
+
+    template <unsigned BITS = 64, typename U>
+    static uint8_t* put(uint8_t* p, U value) {
+        constexpr size_t len_max = bound_len<BITS, U>;
+        uint64_t v = (std::make_unsigned_t<U>)value;
+        if (kernel != scalar && (len_max < 9 || v < WORD_LIMIT)) {
+            uint64_t len = (std::bit_width(v | 1) + 6) / 7;
+            store(p, scatter(v) | ((uint64_t)mark << (8 * len - 8)));
+            return p + len;
+        }
+        if constexpr (len_max < 9) {
+            for (size_t i = 1; i < len_max && v > trim; ++i) {
+                *p++ = v & trim;
+                v  >>= 7;
+            }
+            *p++ = v | mark;
+            return p;
+        }
+        do {
+            *p++ = v & trim;
+            v  >>= 7;
+        } while (v != 0);
+        p[-1] |= mark;
+        return p;
+    }
+
+    // read the varint starting at p, never past end; BITS bounds it as in put(), unbounded by default
+    template <unsigned BITS = 64, typename W>
+    static uint8_t* get(uint8_t* p, const uint8_t* end, W& value) {
+        constexpr size_t len_max = bound_len<BITS, uint64_t>;
+        if (kernel != scalar) {
+            // the first marked byte ends the varint
+            uint64_t w   = load(p);
+            uint64_t m   = w & MARKS;
+            uint64_t len = (unsigned)std::countr_zero(m) / 8 + 1;
+            if (m && len <= (uint64_t)(end - p)) {
+                value = (W)gather(w & (~0ull >> (64 - 8 * len)));
+                return p + len;
+            }
+        }
+        if constexpr (len_max < 9) {
+            uint64_t v = 0;
+            for (size_t i = 0; i < len_max && p != end; ++i) {
+                uint8_t b = *p++;
+                v        |= (uint64_t)(b & trim) << (7 * i);
+                if (b & mark)
                     break;
             }
+            value = (W)v;
+            return p;
         }
+        uint8_t cnt = 0;
+        value       = 0;
+
+        while (p != end && ! (*p & mark)) {
+            value |= ((W)(*p++ & trim) << cnt);
+            cnt   += 7;
+        }
+        if (p != end)
+            value |= ((W)(*p++ & trim)) << cnt;
+        return p;
     }
 
-    template <destr_t U, dir_t V>
-    void _decode_raw(uint8_t& val) {
-        if (! is_valid<V>())
-            return;
+    // read the varint ending right before p, never in front of head; BITS as in get()
+    template <unsigned BITS = 64, typename W>
+    static uint8_t* rget(uint8_t* p, const uint8_t* head, W& value) {
+        constexpr size_t len_max = bound_len<BITS, uint64_t>;
+        if (kernel != scalar) {
+            // the closest marked byte in front of our own (or the chunk head) ends the previous field
+            uint64_t w     = load(p - 8);
+            uint64_t m     = w & (MARKS >> 8);
+            uint64_t avail = p - head;
+            if (avail < 8)
+                m |= (uint64_t)mark << (56 - 8 * avail);
+            if (m) {
+                uint64_t len = 7 - (63 - (unsigned)std::countl_zero(m)) / 8;
+                value        = (W)gather(w >> (64 - 8 * len));
+                return p - len;
+            }
+        }
+        if constexpr (len_max < 9) {
+            uint64_t v = *--p & trim;
+            for (size_t i = 1; i < len_max && p != head && ! (p[-1] & mark); ++i)
+                v = v << 7 | *--p;
+            value = (W)v;
+            return p;
+        }
+        value = *--p & trim;
+        while (p != head && ! (p[-1] & mark)) {
+            value <<= 7;
+            value  |= *--p;
+        }
+        return p;
+    }
 
-        if constexpr (V == Coder::l2r) {
-            val = *s_it;
-            advance<U, V>(s_it);
+    template <dir_t V>
+    bool is_valid() {
+        if constexpr (V == l2r) {
+            if (s_it.p != s_it.c->tail)
+                return true;
+            if (Chunk* n = next(s_it.c)) {
+                s_it = {thaw(n)->head, n, s_it.addr};
+                return true;
+            }
+            return false;
+        } else {
+            if (s_rit.p != s_rit.c->head)
+                return true;
+            if (Chunk* n = prev(s_rit.c)) {
+                s_rit = {thaw(n)->tail, n, s_rit.addr};
+                return true;
+            }
+            return false;
+        }
+    }
+
+    // destructive mode: drop everything in front of (l2r) or behind (r2l) the cursor
+    template <dir_t V>
+    void consume() {
+        if constexpr (V == l2r) {
+            while (s_it.c != &chunks.front()) {
+                live_bytes -= live(chunks.front());
+                drop_front();
+            }
+            live_bytes   -= s_it.p - s_it.c->head;
+            s_it.c->head  = s_it.p;
+            if (s_rit.c == s_it.c && s_rit.p < s_it.p)
+                s_rit = s_it;
+            if (s_it.p == s_it.c->tail && chunks.size() > 1) {
+                drop_front();
+                s_it = {chunks.front().head, &chunks.front(), s_it.addr};
+            }
         } else {
-            val = *s_rit;
-            advance<U, V>(s_rit);
+            while (s_rit.c != &chunks.back()) {
+                live_bytes -= live(chunks.back());
+                drop_back();
+            }
+            live_bytes    -= s_rit.c->tail - s_rit.p;
+            s_rit.c->tail  = s_rit.p;
+            if (s_it.c == s_rit.c && s_it.p > s_rit.p)
+                s_it = s_rit;
+            if (s_rit.p == s_rit.c->head && chunks.size() > 1) {
+                drop_back();
+                s_rit = {chunks.back().tail, &chunks.back(), s_rit.addr};
+            }
         }
     }
 
 private:
-    const uint8_t mark = 0x80;
-    const uint8_t trim = 0x7F;
+    friend class Trace;
+    template <typename>
+    friend class LiveTrace;
 
-    std::deque<uint8_t>                   s;
-    std::deque<uint8_t>::iterator         s_it;
-    std::deque<uint8_t>::reverse_iterator s_rit;
+    static constexpr uint64_t MARKS      = 0x8080808080808080;
+    static constexpr uint64_t TRIMS      = 0x7F7F7F7F7F7F7F7F;
+    static constexpr uint64_t WORD_LIMIT = 1ull << 56;
 
-    template <dir_t V>
-    bool is_valid() {
-        if constexpr (V == l2r)
-            return s_it != s.end();
-        else
-            return s_rit != s.rend();
+    static inline kernel_t kernel = scalar;
+
+    size_t            chunk_size;
+    size_t            live_bytes = 0;
+    std::deque<Chunk> chunks;
+    size_t            budget = 0;
+    evict_t           evict  = drop;
+    bool              over   = false; // see within_budget()
+    BlockStats        blockStats;
+
+    static uint64_t load(const uint8_t* p) {
+        uint64_t w;
+        std::memcpy(&w, p, sizeof(w));
+        return w;
+    }
+    static void store(uint8_t* p, uint64_t w) {
+        std::memcpy(p, &w, sizeof(w));
     }
 
-    template <destr_t U, dir_t V, typename W>
-    bool advance(W& it) {
-        it++;
-        if constexpr (U == destr) {
-            if constexpr (V == l2r)
-                s.pop_front();
-            else
-                s.pop_back();
+    // 7 bit groups of a value < 2^56 -> one group per byte, and back
+    static uint64_t spread(uint64_t x) {
+        x = (x & 0x000000000FFFFFFF) | ((x & 0x00FFFFFFF0000000) << 4);
+        x = (x & 0x00003FFF00003FFF) | ((x & 0x0FFFC0000FFFC000) << 2);
+        x = (x & 0x007F007F007F007F) | ((x & 0x3F803F803F803F80) << 1);
+        return x;
+    }
+    static uint64_t compact(uint64_t x) {
+        x &= TRIMS;
+        x  = (x & 0x007F007F007F007F) | ((x & 0x7F007F007F007F00) >> 1);
+        x  = (x & 0x00003FFF00003FFF) | ((x & 0x3FFF00003FFF0000) >> 2);
+        x  = (x & 0x000000000FFFFFFF) | ((x & 0x0FFFFFFF00000000) >> 4);
+        return x;
+    }
+#ifdef CODER_BMI2
+    __attribute__((target("bmi2"))) static uint64_t deposit(uint64_t x) {
+        return _pdep_u64(x, TRIMS);
+    }
+    __attribute__((target("bmi2"))) static uint64_t extract(uint64_t x) {
+        return _pext_u64(x, TRIMS);
+    }
+#else
+    static uint64_t deposit(uint64_t x) {
+        return spread(x);
+    }
+    static uint64_t extract(uint64_t x) {
+        return compact(x);
+    }
+#endif
+    static uint64_t scatter(uint64_t x) {
+        return kernel == bmi2 ? deposit(x) : spread(x);
+    }
+    static uint64_t gather(uint64_t x) {
+        return kernel == bmi2 ? extract(x) : compact(x);
+    }
+
+    static uint8_t* start(const Chunk& c) {
+        return c.mem.get() + PADDING;
+    }
+    static size_t owned(const Chunk& c) {
+        if (c.frozen)
+            return c.packed.size();
+        return c.attached ? 0 : c.cap - start(c) + 2 * PADDING;
+    }
+    static size_t live(const Chunk& c) {
+        return c.frozen ? c.frozen : c.tail - c.head;
+    }
+    static size_t offset(const Cursor& it) {
+        return it.c->base + (it.p - start(*it.c));
+    }
+    static size_t head_offset(const Chunk& c) {
+        return c.frozen ? c.base : c.base + (c.head - start(c));
+    }
+
+    void new_chunk(size_t cap) {
+        size_t base = 0, seq = 0;
+        if (! chunks.empty()) {
+            // only a single, last chunk can be empty
+            Chunk& last = chunks.back();
+            base        = last.base + (last.tail - start(last));
+            seq         = last.seq + 1;
+            if (last.head == last.tail) {
+                if (! last.attached && (size_t)(last.cap - start(last)) >= cap) {
+                    last.head = last.tail = start(last);
+                    last.base = base;
+                    last.from = {base, backOrd, backClk, backAddr};
+                    reset_iter();
+                    return;
+                }
+                chunks.pop_back();
+                --seq;
+            }
         }
-        return is_valid<V>();
+        auto mem = std::make_shared<uint8_t[]>(cap + 2 * PADDING);
+        auto ptr = mem.get() + PADDING;
+        chunks.push_back({std::move(mem), ptr, ptr, ptr + cap, base, seq, {base, backOrd, backClk, backAddr}});
+        if (chunks.size() == 1)
+            reset_iter();
+        enforce_budget();
+    }
+
+    bool can_freeze(Chunk& c) {
+        return &c != &chunks.back() && ! c.attached && ! c.frozen && c.head != c.tail && &c != s_it.c && &c != s_rit.c;
+    }
+
+    // Compress the live bytes of c, its memory is released.
+    void freeze(Chunk& c) {
+        size_t n = c.tail - c.head;
+        c.base   = offset({c.head, &c});
+        Block::pack({c.head, n}, c.packed);
+        c.packed.shrink_to_fit();
+        c.frozen = n;
+        c.mem.reset();
+        c.head = c.tail = c.cap = nullptr;
+
+        blockStats.blocks += 1;
+        blockStats.raw    += n;
+        blockStats.packed += c.packed.size();
+    }
+
+    // Decompress c again (if needed), its live bytes then start its writable area.
+    Chunk* thaw(Chunk* c) {
+        if (! c->frozen)
+            return c;
+        size_t n   = c->frozen;
+        auto   t0  = std::chrono::steady_clock::now();
+        auto   mem = std::make_shared<uint8_t[]>(n + 2 * PADDING);
+        auto   ptr = mem.get() + PADDING;
+        Block::unpack(c->packed, ptr, n);
+        blockStats.thawed  += n;
+        blockStats.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+        c->mem    = std::move(mem);
+        c->head   = ptr;
+        c->tail   = c->cap = ptr + n;
+        c->packed = {};
+        c->frozen = 0;
+        return c;
+    }
+
+    void drop_oldest() {
+        Chunk& c = chunks.front();
+        Chunk& n = chunks[1];
+        live_bytes -= live(c);
+        elements   -= std::min(elements, n.from.ordinal - frontOrd);
+        frontOrd    = n.from.ordinal;
+        frontClk    = n.from.clk;
+        frontAddr   = n.from.addr;
+        drop_front();
+        while (! marks.empty() && marks.front().offset < begin_offset())
+            marks.pop_front();
+    }
+
+    Chunk* next(Chunk* c) {
+        if (c == &chunks.back())
+            return nullptr;
+        return &chunks[c->seq - chunks.front().seq + 1];
+    }
+    Chunk* prev(Chunk* c) {
+        if (c == &chunks.front())
+            return nullptr;
+        return &chunks[c->seq - chunks.front().seq - 1];
     }
+
+    void drop_front() {
+        Chunk* c = &chunks.front();
+        Chunk* n = &chunks[1];
+        if (s_it.c == c || s_rit.c == c)
+            thaw(n);
+        if (s_it.c == c)
+            s_it = {n->head, n, n->from.addr};
+        if (s_rit.c == c)
+            s_rit = {n->head, n, n->from.addr};
+        chunks.pop_front();
+    }
+    void drop_back() {
+        Chunk* c = &chunks.back();
+        Chunk* n = &chunks[chunks.size() - 2];
+        if (s_it.c == c || s_rit.c == c)
+            thaw(n);
+        if (s_it.c == c)
+            s_it = {n->tail, n, c->from.addr};
+        if (s_rit.c == c)
+            s_rit = {n->tail, n, c->from.addr};
+        chunks.pop_back();
+    }
+};
+
+struct MemEntry {
+    uint64_t clk;
+    uint32_t addr;
+    uint16_t val;
+
+    bool operator==(const MemEntry&) const = default;
 };
 
 class MemCoder : public Coder {
 public:
-    template <typename T>
+    using Coder::Coder;
+
+    using Coder::seek;
+
+    // Field modes, combined as flags. The plain layout is the one described at the top.
+    // Delta fields are relative to the previous entry, so seeks by offset have to walk from the
+    // closest index mark to pick up their context (see Pos::addr).
+    enum mode_t : uint8_t {
+        plain      = 0,
+        addr_delta = 1 << 0, // addr as zig-zag delta from the previous entry's addr
+        same_addr  = 1 << 1, // an entry repeating the previous addr leaves it out; needs addr_delta
+        val_zigzag = 1 << 2, // val as zig-zag of its int16 value, small negative deltas stay short
+        val_xor    = 1 << 3, // val is an XOR delta: stored as is, tells the consumer how to apply it
+    };
+
+    // same_addr entries (flagged in the lowest bit of clk and val, so both directions see it first):
+    // |------ n byte -------|------------------ n byte -------------------|
+    // varint (clk << 1) | 1, varint (val << 1) | 1
+    // The flagged clk takes 65 bits for clk deltas from 2^63 on: always 10 bytes then, with the
+    // top bit of clk in the second bit of the last byte.
+
+    // Select the field modes; only possible while the coder holds no entries.
+    bool set_mode(uint8_t m) {
+        if (get_size() || ((m & same_addr) && ! (m & addr_delta)))
+            return false;
+        mode = m;
+        return true;
+    }
+
+    // ADDR_BITS: addr is known to be below 1 << ADDR_BITS (see Coder::put()); the format stays the same
+    template <unsigned ADDR_BITS = 32, typename T>
     void encode(T clk, uint32_t addr, uint16_t val) {
-        _encode(clk);
-        _encode(addr);
-        _encode(val);
+        Chunk& c = reserve(mode ? MAX_ENTRY : max_len<T> + max_len<uint32_t> + max_len<uint16_t>);
+        index(c.tail, clk);
+        commit(c, put_entry<ADDR_BITS>(c.tail, clk, addr, val, backAddr));
         ++elements;
     }
 
-    template <Coder::destr_t U = Coder::non_destr, Coder::dir_t V = Coder::l2r, typename W>
+    // Encoded bytes of each field (clk, addr, val) of the entry encode() would write next
+    template <typename T>
+    std::array<uint8_t, 3> layout(T clk, uint32_t addr, uint16_t val) {
+        if (mode == plain)
+            return {varint_len(clk), varint_len(addr), varint_len(val)};
+        bool     same = (mode & same_addr) && addr == backAddr;
+        uint64_t c    = clk;
+        uint32_t v    = mode & val_zigzag ? zigzag((int16_t)val) : val;
+        uint8_t  cl   = varint_len(c);
+        if (mode & same_addr) {
+            cl = c >> 63 ? max_len<uint64_t> : varint_len(c << 1 | same);
+            v  = v << 1 | same;
+        }
+        uint8_t a = same ? 0 : varint_len(mode & addr_delta ? zigzag(addr - backAddr) : addr);
+        return {cl, a, varint_len(v)};
+    }
+
+    void encode_batch(std::span<const MemEntry> entries) {
+        for (size_t i = 0; i < entries.size();) {
+            Chunk&   c = reserve(MAX_ENTRY);
+            size_t   n = std::min<size_t>(entries.size() - i, (c.cap - c.tail) / MAX_ENTRY);
+            uint8_t* p = c.tail;
+            for (auto& e : entries.subspan(i, n)) {
+                index(p, e.clk);
+                p = put_entry(p, e.clk, e.addr, e.val, backAddr);
+            }
+            commit(c, p);
+
+            i        += n;
+            elements += n;
+        }
+    }
+
+    template <Coder::destr_t U = Coder::non_destr, Coder::dir_t V = Coder::l2r, unsigned ADDR_BITS = 32, typename W>
     void decode(W& clk, uint32_t& addr, uint16_t& val) {
+        Pos from{};
         if constexpr (U == Coder::destr) {
             if (get_size())
                 --elements;
+            from = unindex_from<V>(reader());
         }
-        if constexpr (V == Coder::l2r) {
-            _decode<U, V>(clk);
-            _decode<U, V>(addr);
-            _decode<U, V>(val);
-        } else {
-            _decode<U, V>(val);
-            _decode<U, V>(addr);
-            _decode<U, V>(clk);
+        if (! is_valid<V>())
+            return;
+
+        if constexpr (V == Coder::l2r)
+            s_it.p = get_entry<ADDR_BITS>(s_it.p, s_it.c->tail, clk, addr, val, s_it.addr);
+        else
+            s_rit.p = rget_entry<ADDR_BITS>(s_rit.p, s_rit.c->head, clk, addr, val, s_rit.addr);
+
+        if constexpr (U == Coder::destr) {
+            consume<V>();
+            unindex<V>(from, 1, clk, V == Coder::l2r ? s_it.addr : s_rit.addr);
         }
     }
 
-    size_t num_elements() {
-        return elements;
+    // Decodes up to out.size() entries, in reading order (r2l: newest first). Returns their number.
+    template <Coder::destr_t U = Coder::non_destr, Coder::dir_t V = Coder::l2r, unsigned ADDR_BITS = 32>
+    size_t decode_batch(std::span<MemEntry> out) {
+        Pos from{};
+        if constexpr (U == Coder::destr)
+            from = unindex_from<V>(reader());
+
+        size_t n = 0;
+        while (n < out.size() && is_valid<V>()) {
+            if constexpr (V == Coder::l2r) {
+                uint8_t* p   = s_it.p;
+                uint8_t* end = s_it.c->tail;
+                for (; n < out.size() && p != end; ++n)
+                    p = get_entry<ADDR_BITS>(p, end, out[n].clk, out[n].addr, out[n].val, s_it.addr);
+                s_it.p = p;
+            } else {
+                uint8_t* p    = s_rit.p;
+                uint8_t* head = s_rit.c->head;
+                for (; n < out.size() && p != head; ++n)
+                    p = rget_entry<ADDR_BITS>(p, head, out[n].clk, out[n].addr, out[n].val, s_rit.addr);
+                s_rit.p = p;
+            }
+            if constexpr (U == Coder::destr)
+                consume<V>();
+        }
+        if constexpr (U == Coder::destr) {
+            uint64_t clk = 0;
+            for (auto& e : out.first(n))
+                clk += e.clk;
+            unindex<V>(from, n, clk, V == Coder::l2r ? s_it.addr : s_rit.addr);
+            elements -= std::min(n, elements);
+        }
+        return n;
+    }
+
+    // Move a cursor to the entry boundary at offs (see Coder::seek()).
+    void seek(Coder::dir_t dir, size_t offs) {
+        if (mode & addr_delta)
+            Coder::seek(dir, locate(offs, reader()));
+        else
+            Coder::seek(dir, offs);
+    }
+
+    // The entry boundary in front of the first entry with an absolute clk (sum of the clk fields
+    // of all entries up to it) >= clk, found through the clk index. The cursors stay put.
+    Pos find(uint64_t clk) {
+        return Coder::find(clk, reader());
+    }
+
+    // Position both cursors at find(clk).
+    Pos seek(uint64_t clk) {
+        Pos pos = find(clk);
+        Coder::seek(Coder::l2r, pos);
+        Coder::seek(Coder::r2l, pos);
+        return pos;
+    }
+
+    // Decode the entries between the entry boundaries from and to (see resync_points()) without
+    // touching the cursors, calling f(const MemEntry&) with clk as stored (the delta). Several
+    // scans may run concurrently, but nothing may modify the coder meanwhile. Returns to.
+    template <typename F>
+    Pos scan(Pos from, Pos to, F f) {
+        MemEntry e;
+        return Coder::scan(from, to.offset, [&](uint8_t* p, const uint8_t* end, uint64_t& clk, uint32_t& ctx) {
+            p   = get_entry(p, end, e.clk, e.addr, e.val, ctx);
+            clk = e.clk;
+            f(std::as_const(e));
+            return p;
+        });
+    }
+
+    // Independent cursors over the live entries, see Coder::Iterator
+    using iterator = Iterator<MemCoder, MemEntry>;
+    iterator begin() const {
+        return {this, front_pos()};
+    }
+    iterator end() const {
+        return {this, back_pos()};
+    }
+
+    // Drop all entries from the entry boundary offs on.
+    Pos truncate(size_t offs) {
+        Pos pos = locate(offs, reader());
+        Coder::truncate(pos.offset);
+        s_rit.addr = pos.addr;
+        unindex<Coder::r2l>(pos, 0, 0, pos.addr);
+        elements = backOrd - frontOrd;
+        return pos;
     }
 
 private:
     using Coder::_encode, Coder::_decode, Coder::_encode_raw, Coder::_decode_raw;
-    size_t elements = 0;
+
+    static constexpr size_t MAX_ENTRY = max_len<uint64_t> + max_len<uint32_t> + max_len<uint16_t>;
+
+    static uint32_t zigzag(int32_t v) {
+        return (uint32_t)v << 1 ^ (uint32_t)(v >> 31);
+    }
+    static int32_t unzigzag(uint32_t v) {
+        return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+    }
+
+    // Bounds of the mode dependent fields: deltas take a sign bit, same_addr a flag bit
+    static constexpr unsigned VAL_BITS = 16 + 1;
+
+    // The clk field of same_addr entries, (clk << 1) | same, as a 65 bit varint (see mode_t)
+    template <typename T>
+    static uint8_t* put_flagged(uint8_t* p, T clk, bool same) {
+        uint64_t c = (uint64_t)clk << 1 | same;
+        if (! ((uint64_t)clk >> 63))
+            return put(p, c);
+        for (size_t i = 1; i < max_len<uint64_t>; ++i, c >>= 7)
+            *p++ = c & trim;
+        *p++ = c | 2 | mark;
+        return p;
+    }
+    // Bit 64 of the flagged clk varint in [from, to), as the top bit of clk
+    static uint64_t top_bit(const uint8_t* from, const uint8_t* to) {
+        return (uint64_t)(to - from == max_len<uint64_t> && (to[-1] & 2)) << 63;
+    }
+
+    // ctx: the previous entry's addr, becomes addr
+    template <unsigned ADDR_BITS = 32, typename T>
+    uint8_t* put_entry(uint8_t* p, T clk, uint32_t addr, uint16_t val, uint32_t& ctx) {
+        if (mode == plain) {
+            ctx = addr;
+            p   = put(p, clk);
+            p   = put<ADDR_BITS>(p, addr);
+            return put(p, val);
+        }
+        bool     same = (mode & same_addr) && addr == ctx;
+        uint32_t v    = mode & val_zigzag ? zigzag((int16_t)val) : val;
+        if (mode & same_addr) {
+            p = put_flagged(p, clk, same);
+            v = v << 1 | same;
+        } else {
+            p = put(p, clk);
+        }
+        if (! same) {
+            if (mode & addr_delta)
+                p = put<ADDR_BITS + 1>(p, zigzag(addr - ctx));
+            else
+                p = put<ADDR_BITS>(p, addr);
+        }
+        ctx = addr;
+        return put<VAL_BITS>(p, v);
+    }
+
+    // ctx: Pos::addr in front of the entry at p, becomes the one behind it
+    template <unsigned ADDR_BITS = 32, typename W>
+    uint8_t* get_entry(uint8_t* p, const uint8_t* end, W& clk, uint32_t& addr, uint16_t& val, uint32_t& ctx) const {
+        if (mode == plain) {
+            p   = get(p, end, clk);
+            p   = get<ADDR_BITS>(p, end, addr);
+            ctx = addr;
+            return get<16>(p, end, val);
+        }
+        uint64_t c;
+        uint32_t v;
+        uint8_t* f = p;
+        p          = get(p, end, c);
+        bool same  = (mode & same_addr) && (c & 1);
+        clk        = (W)(mode & same_addr ? c >> 1 | top_bit(f, p) : c);
+        if (! same) {
+            uint32_t a;
+            if (mode & addr_delta) {
+                p   = get<ADDR_BITS + 1>(p, end, a);
+                ctx = ctx + unzigzag(a);
+            } else {
+                p   = get<ADDR_BITS>(p, end, a);
+                ctx = a;
+            }
+        }
+        addr = ctx;
+        p    = get<VAL_BITS>(p, end, v);
+        val  = unfold(v);
+        return p;
+    }
+
+    // ctx: Pos::addr behind the entry ending at p (its addr), becomes the one in front of it
+    template <unsigned ADDR_BITS = 32, typename W>
+    uint8_t* rget_entry(uint8_t* p, const uint8_t* head, W& clk, uint32_t& addr, uint16_t& val, uint32_t& ctx) const {
+        if (mode == plain) {
+            p = rget<16>(p, head, val);
+            p = rget<ADDR_BITS>(p, head, addr);
+            return rget(p, head, clk);
+        }
+        uint32_t v;
+        uint64_t c;
+        p         = rget<VAL_BITS>(p, head, v);
+        bool same = (mode & same_addr) && (v & 1);
+        val       = unfold(v);
+        addr      = ctx;
+        if (! same) {
+            uint32_t a;
+            if (mode & addr_delta) {
+                p    = rget<ADDR_BITS + 1>(p, head, a);
+                ctx -= unzigzag(a);
+            } else {
+                p    = rget<ADDR_BITS>(p, head, a);
+                addr = a;
+            }
+        }
+        uint8_t* f = p;
+        p          = rget(p, head, c);
+        clk        = (W)(mode & same_addr ? c >> 1 | top_bit(p, f) : c);
+        return p;
+    }
+
+    friend iterator;
+    template <typename>
+    friend class LiveReader;
+    uint8_t* get_entry(uint8_t* p, const uint8_t* end, MemEntry& e, uint32_t& ctx) const {
+        return get_entry(p, end, e.clk, e.addr, e.val, ctx);
+    }
+    uint8_t* rget_entry(uint8_t* p, const uint8_t* head, MemEntry& e, uint32_t& ctx) const {
+        return rget_entry(p, head, e.clk, e.addr, e.val, ctx);
+    }
+
+    uint16_t unfold(uint32_t v) const {
+        if (mode & same_addr)
+            v >>= 1;
+        return mode & val_zigzag ? (uint16_t)unzigzag(v) : (uint16_t)v;
+    }
+
+    // Entry parser for the index walks
+    struct Reader {
+        MemCoder* mc;
+        uint8_t* operator()(uint8_t* p, const uint8_t* end, uint64_t& clk, uint32_t& ctx) const {
+            uint32_t addr;
+            uint16_t val;
+            return mc->get_entry(p, end, clk, addr, val, ctx);
+        }
+    };
+    Reader reader() {
+        return {this};
+    }
+};
+
+struct RegEntry {
+    uint64_t clk;
+    uint8_t  idx1;       // (low word) register
+    uint8_t  idx2;       // high word register of two-register entries, derived from idx1
+    uint16_t low_value;
+    uint16_t high_value;
+    bool     two_regs;
+
+    bool operator==(const RegEntry&) const = default;
 };
 
 class RegCoder : public Coder {
 public:
-    size_t num_elements() {
-        return elements;
-    }
+    using Coder::Coder;
+    using Coder::seek;
 
     template <typename T>
     void encode(T clk, uint8_t idx, uint16_t value) {
@@ -228,69 +1430,206 @@ public:
         reg_encode<true>(clk, idx1, high_value, low_value);
     }
 
+    // Encoded bytes of each field (clk, the index byte, values) of the entry encode() would write
+    // (high_value 0 for one-register entries)
+    template <typename T>
+    static std::array<uint8_t, 3> layout(T clk, uint16_t high_value, uint16_t low_value) {
+        return {varint_len(clk), 1, varint_len((high_value << 15) | (low_value >> 1))};
+    }
+
+    void encode_batch(std::span<const RegEntry> entries) {
+        for (size_t i = 0; i < entries.size();) {
+            Chunk&   c = reserve(MAX_ENTRY);
+            size_t   n = std::min<size_t>(entries.size() - i, (c.cap - c.tail) / MAX_ENTRY);
+            uint8_t* p = c.tail;
+            for (auto& e : entries.subspan(i, n)) {
+                index(p, e.clk);
+                if (e.two_regs)
+                    p = put_entry<true>(p, e.clk, e.idx1, e.high_value, e.low_value);
+                else
+                    p = put_entry<false>(p, e.clk, e.idx1, 0, e.low_value);
+            }
+            commit(c, p);
+
+            i        += n;
+            elements += n;
+        }
+    }
+
     template <Coder::destr_t U = Coder::non_destr, Coder::dir_t V = Coder::l2r, typename W>
     bool decode(W& clk, uint8_t& idx2, uint16_t& high_value, uint8_t& idx1, uint16_t& low_value) {
-        uint8_t  raw;
-        uint32_t tmp_value;
-        bool     two_regs = false;
+        uint8_t  raw = 0;
+        uint32_t tmp_value = 0;
+        Pos      from{};
+        size_t   offs = tell(V);
 
         if constexpr (U == Coder::destr) {
             if (get_size())
                 --elements;
+            from = unindex_from<V>(read_entry);
         }
         if constexpr (V == Coder::l2r) {
             _decode_raw<U, V>(raw);
-
-            uint8_t value_LSB = (raw >> 6) & 1;
-            idx1              = raw & 0x1F;
-            two_regs          = (raw >> 5) & 1;
-
             _decode<U, V>(tmp_value);
-            tmp_value = ((tmp_value) << 1) | value_LSB;
             _decode<U, V>(clk);
         } else {
             _decode<U, V>(clk);
             _decode<U, V>(tmp_value);
             _decode_raw<U, V>(raw);
+        }
+        if constexpr (U == Coder::destr) {
+            if (tell(V) != offs)
+                unindex<V>(from, 1, clk);
+        }
+        return unpack(raw, tmp_value, idx2, high_value, idx1, low_value);
+    }
 
-            uint8_t value_LSB = (raw >> 6) & 1;
-            idx1              = raw & 0x1F;
-            tmp_value         = ((tmp_value) << 1) | value_LSB;
-            two_regs          = (raw >> 5) & 1;
+    // Decodes up to out.size() entries, in reading order (r2l: newest first). Returns their number.
+    template <Coder::destr_t U = Coder::non_destr, Coder::dir_t V = Coder::l2r>
+    size_t decode_batch(std::span<RegEntry> out) {
+        Pos from{};
+        if constexpr (U == Coder::destr)
+            from = unindex_from<V>(read_entry);
+
+        size_t n = 0;
+        while (n < out.size() && is_valid<V>()) {
+            if constexpr (V == Coder::l2r) {
+                uint8_t* p   = s_it.p;
+                uint8_t* end = s_it.c->tail;
+                for (; n < out.size() && p != end; ++n)
+                    p = get_entry(p, end, out[n]);
+                s_it.p = p;
+            } else {
+                uint8_t* p    = s_rit.p;
+                uint8_t* head = s_rit.c->head;
+                for (; n < out.size() && p != head; ++n)
+                    p = rget_entry(p, head, out[n]);
+                s_rit.p = p;
+            }
+            if constexpr (U == Coder::destr)
+                consume<V>();
         }
-        low_value  = tmp_value & 0xFFFF;
-        high_value = tmp_value >> 16;
+        if constexpr (U == Coder::destr) {
+            uint64_t clk = 0;
+            for (auto& e : out.first(n))
+                clk += e.clk;
+            unindex<V>(from, n, clk);
+            elements -= std::min(n, elements);
+        }
+        return n;
+    }
 
-        idx2 = 0;
-        if (two_regs)
-            idx2 = decode_idx2(idx1);
+    // See MemCoder::begin()
+    using iterator = Iterator<RegCoder, RegEntry>;
+    iterator begin() const {
+        return {this, front_pos()};
+    }
+    iterator end() const {
+        return {this, back_pos()};
+    }
 
-        return two_regs;
+    // See MemCoder::find() and seek()
+    Pos find(uint64_t clk) {
+        return Coder::find(clk, read_entry);
+    }
+    Pos seek(uint64_t clk) {
+        Pos pos = find(clk);
+        seek(Coder::l2r, pos.offset);
+        seek(Coder::r2l, pos.offset);
+        return pos;
     }
 
-private:
-    using Coder::_encode, Coder::_decode, Coder::_encode_raw, Coder::_decode_raw;
-    size_t elements = 0;
+    // See MemCoder::truncate()
+    Pos truncate(size_t offs) {
+        Pos pos = locate(offs, read_entry);
+        Coder::truncate(pos.offset);
+        unindex<Coder::r2l>(pos, 0, 0);
+        elements = backOrd - frontOrd;
+        return pos;
+    }
 
-    uint8_t decode_idx2(uint8_t idx1) {
+    static uint8_t decode_idx2(uint8_t idx1) {
         if (idx1 & (1 << 4))
             return idx1 - 1;
         else
             return idx1 | (1 << 4);
     }
 
+private:
+    using Coder::_encode, Coder::_decode, Coder::_encode_raw, Coder::_decode_raw;
+
+    static constexpr unsigned VALUE_BITS = 16 + 15; // high value and the low one without its lsb
+    static constexpr size_t   MAX_ENTRY  = 1 + max_len<uint32_t> + max_len<uint64_t>;
+
+    static bool unpack(uint8_t raw, uint32_t tmp_value,
+                       uint8_t& idx2, uint16_t& high_value, uint8_t& idx1, uint16_t& low_value) {
+        uint8_t value_LSB = (raw >> 6) & 1;
+        bool    two_regs  = (raw >> 5) & 1;
+        idx1              = raw & 0x1F;
+        tmp_value         = ((tmp_value) << 1) | value_LSB;
+
+        low_value  = tmp_value & 0xFFFF;
+        high_value = tmp_value >> 16;
+
+        idx2 = 0;
+        if (two_regs)
+            idx2 = decode_idx2(idx1);
+
+        return two_regs;
+    }
+
     template <bool two, typename T>
-    void reg_encode(T clk, uint8_t idx, uint16_t high_value, uint16_t low_value) {
+    static uint8_t* put_entry(uint8_t* p, T clk, uint8_t idx, uint16_t high_value, uint16_t low_value) {
         idx |= 0x80;                 //bit7 := 1 // leb128 decode marker
         idx |= (low_value & 1) << 6; //bit6 := value & 1
         if constexpr (two)           //
             idx |= TWO_REG_BIT;      //bit5 := 1
         else                         //
             idx &= ~TWO_REG_BIT;     //bit5 := 0
-        _encode_raw(idx);
 
-        _encode((high_value << 15) | (low_value >> 1));
-        _encode(clk);
+        *p++ = idx;
+        p    = put<VALUE_BITS>(p, (high_value << 15) | (low_value >> 1));
+        return put(p, clk);
+    }
+
+    friend iterator;
+    template <typename>
+    friend class LiveReader;
+    static uint8_t* get_entry(uint8_t* p, const uint8_t* end, RegEntry& e) {
+        uint8_t  raw = *p++;
+        uint32_t tmp_value;
+        p          = get<VALUE_BITS>(p, end, tmp_value);
+        p          = get(p, end, e.clk);
+        e.two_regs = unpack(raw, tmp_value, e.idx2, e.high_value, e.idx1, e.low_value);
+        return p;
+    }
+    static uint8_t* rget_entry(uint8_t* p, const uint8_t* head, RegEntry& e) {
+        uint32_t tmp_value;
+        p           = rget(p, head, e.clk);
+        p           = rget<VALUE_BITS>(p, head, tmp_value);
+        uint8_t raw = *--p;
+        e.two_regs  = unpack(raw, tmp_value, e.idx2, e.high_value, e.idx1, e.low_value);
+        return p;
+    }
+    // Iterator's interface: register entries have no delta context
+    static uint8_t* get_entry(uint8_t* p, const uint8_t* end, RegEntry& e, uint32_t&) {
+        return get_entry(p, end, e);
+    }
+    static uint8_t* rget_entry(uint8_t* p, const uint8_t* head, RegEntry& e, uint32_t&) {
+        return rget_entry(p, head, e);
+    }
+
+    static uint8_t* read_entry(uint8_t* p, const uint8_t* end, uint64_t& clk, uint32_t&) {
+        uint32_t tmp_value;
+        p = get<VALUE_BITS>(p + 1, end, tmp_value);
+        return get(p, end, clk);
+    }
+
+    template <bool two, typename T>
+    void reg_encode(T clk, uint8_t idx, uint16_t high_value, uint16_t low_value) {
+        Chunk& c = reserve(1 + max_len<uint32_t> + max_len<T>);
+        index(c.tail, clk);
+        commit(c, put_entry<two>(c.tail, clk, idx, high_value, low_value));
         ++elements;
     }
 };
@@ -2,9 +2,23 @@
 // MIT License. Copyright 2023 Mirko Palmer (derbroti)
 ////////
 
+#pragma once
+
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <optional>
 #include <span>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 #include "coder.h"
+#include "live.h"
+#include "pages.h"
+#include "ring.h"
+#include "writes.h"
 
 template <uint8_t mem_bits>
 concept cpu_mem_constraint = 8 <= mem_bits && mem_bits <= 24;
@@ -12,8 +26,14 @@ concept cpu_mem_constraint = 8 <= mem_bits && mem_bits <= 24;
 template <bool track>
 concept cpu_needs_tracking = track == true;
 
+template <bool instrument>
+concept cpu_needs_instrumentation = instrument == true;
+
 // BIG-endian
-template <uint8_t mem_bits = 16, bool track = false>
+// instrument: count and time the hot paths (see stats()), compiled out otherwise
+// predecode: run from a cache of decoded instruction blocks (see block()), for loops that do not
+// write to their own code
+template <uint8_t mem_bits = 16, bool track = false, bool instrument = false, bool predecode = false>
 requires cpu_mem_constraint<mem_bits>
 class Cpu_t {
 public:
@@ -21,46 +41,437 @@ public:
     uint32_t pc; // ProgramCounter
     uint64_t clk; // Indicates the next to-be-executed instruction
 
-    std::span<const uint16_t> mem_view = memory;
+    // Sparse memory: pages are allocated on first write and shared with checkpoints (see pages.h)
+    using Memory = PagedMemory<(size_t)2 << mem_bits, std::min<size_t>(4096, (size_t)2 << mem_bits)>;
+
+    const Memory&             mem_view = memory;
+    std::span<const uint16_t> reg_view = registers;
 
     Cpu_t(uint8_t id): id(id), pc(0), clk(0) {}
+    ~Cpu_t() {
+        if constexpr (track)
+            set_async_log(false);
+    }
 
     void step() {
-        execute(fetch());
+        if constexpr (track) {
+            if (pc != nextPc || clk != nextClk || clk >= slowClk) [[unlikely]]
+                begin_step();
+        }
+        if constexpr (predecode)
+            run(block(pc & MEMORY).ops[pc % BLOCK]);
+        else
+            execute(fetch());
+        if constexpr (track)
+            flush_register();
         ++pc;
         ++clk;
+        if constexpr (track) {
+            endClk  = clk;
+            nextPc  = pc;
+            nextClk = clk;
+            if (clk >= liveDue) [[unlikely]]
+                publish_live();
+        }
+        if constexpr (instrument)
+            counters.steps.add(1);
+    }
+    // Step n times. With predecode, the cached blocks run back to back: one lookup per block, and
+    // tracked, the jump log and live export are checked once per block (pc runs sequentially
+    // within it), only checkpoints still per step.
+    void step(uint64_t n) {
+        if constexpr (predecode) {
+            while (n) {
+                if constexpr (track) {
+                    if (pc != nextPc || clk != nextClk || clk >= slowClk) [[unlikely]]
+                        begin_step();
+                }
+                // a write to the block's own code drops it (see invalidate()), it gets decoded again
+                const Block& b     = block(pc & MEMORY);
+                uint32_t     first = pc % BLOCK, tag = b.tag, i = first;
+                for (uint32_t end = first + (uint32_t)std::min<uint64_t>(n, BLOCK - first); i < end && b.tag == tag; ++i) {
+                    if constexpr (track) {
+                        if (i != first && clk >= slowClk) [[unlikely]]
+                            auto_checkpoint();
+                        run(b.ops[i]);
+                        flush_register();
+                        ++pc;
+                        ++clk;
+                        endClk = clk;
+                    } else {
+                        run(b.ops[i]);
+                    }
+                }
+                if constexpr (track) {
+                    nextPc  = pc;
+                    nextClk = clk;
+                    if (clk >= liveDue) [[unlikely]]
+                        publish_live();
+                } else {
+                    pc  += i - first;
+                    clk += i - first;
+                }
+                n -= i - first;
+                if constexpr (instrument)
+                    counters.steps.add(i - first);
+            }
+        } else {
+            for (; n; --n)
+                step();
+        }
     }
 
+    // Take a full-state checkpoint every clks cycles and/or every bytes of memory delta log (0 := never).
     template <bool tracking = track>
     requires cpu_needs_tracking<tracking>
-    void sync(uint64_t targetClk) {
-        while (clk < targetClk) {
-            step();
+    void set_checkpoint_interval(uint64_t clks, size_t bytes = 0) {
+        ckptClks  = clks;
+        ckptBytes = bytes;
+        slowClk   = 0;
+    }
+
+    // Bound the memory of each delta log and of the jump log to bytes (0 := unlimited). With the
+    // drop policy the oldest log entries get discarded, so sync() can no longer go back further
+    // than first_clk(). With the compress policy they are decompressed again when sync() needs them.
+    // The jump log has nothing to spill to, it gets compressed instead.
+    template <bool tracking = track>
+    requires cpu_needs_tracking<tracking>
+    void set_log_budget(size_t bytes, Coder::evict_t policy = Coder::drop) {
+        flush_log();
+        mc.set_memory_budget(bytes, policy);
+        rc.set_memory_budget(bytes, policy);
+        jumps.set_memory_budget(bytes, policy == Coder::spill ? Coder::compress : policy);
+    }
+
+    // Field modes of the memory delta log (see MemCoder::mode_t), while it is empty.
+    // With MemCoder::val_xor the log holds XOR deltas instead of wrapped differences.
+    template <bool tracking = track>
+    requires cpu_needs_tracking<tracking>
+    bool set_log_mode(uint8_t mode) {
+        flush_log();
+        return mc.set_mode(mode);
+    }
+
+    // Encode the delta logs on a background thread: the emulation thread only pushes raw writes
+    // into a lock-free ring of RING entries, and waits while it is full. Everything reading the
+    // logs (sync(), checkpoints, ...) waits for the encoder to catch up first (see flush_log()).
+    // The handoff costs more than encoding a write inline: off unless measured to help (README).
+    template <bool tracking = track>
+    requires cpu_needs_tracking<tracking>
+    void set_async_log(bool on) {
+        if (on == (pipe != nullptr))
+            return;
+        if (on) {
+            pipe         = std::make_unique<Pipe>();
+            pipe->thread = std::thread([this] { encode_loop(); });
+        } else {
+            push({0, 0, 0, 0, Write::stop});
+            pipe->thread.join();
+            flush_log();
+            pipe.reset();
         }
-        mc.reset_iter(Coder::r2l);
-        while (mc.num_elements() > 0 && clk > targetClk) {
-            step_back();
+        slowClk = 0;
+        rearm_live();
+    }
+
+    // Barrier: returns once all pushed writes are encoded into the logs.
+    template <bool tracking = track>
+    requires cpu_needs_tracking<tracking>
+    void flush_log() {
+        if (pipe) {
+            uint64_t done, pushed = pipe->pushed.load(std::memory_order_relaxed);
+            while ((done = pipe->encoded.load(std::memory_order_acquire)) != pushed)
+                pipe->encoded.wait(done, std::memory_order_acquire);
+        }
+        if (headsBehind) {
+            // writes are only logged at the end of the logs
+            memHead     = mc.end_offset();
+            regHead     = rc.end_offset();
+            headsBehind = false;
         }
-        lastMemClk = targetClk;
     }
+
+    struct PipeStats {
+        uint64_t writes    = 0; // pushed into the ring
+        uint64_t stalls    = 0; // pushes that had to wait for a full ring
+        size_t   peak      = 0; // highest ring occupancy seen by a push
+        size_t   occupancy = 0; // current ring occupancy
+    };
+    PipeStats pipe_stats() {
+        if (! pipe)
+            return {};
+        auto stats      = pipe->stats;
+        stats.writes    = pipe->pushed.load(std::memory_order_relaxed);
+        stats.occupancy = pipe->ring.size();
+        return stats;
+    }
+
+    // Instrumentation of one delta log
+    struct LogStats {
+        uint64_t encoded      = 0; // entries
+        uint64_t decoded      = 0; // entries read by sync() and step_back()
+        uint64_t fields[3]    = {}; // encoded bytes by field: clk, addr (register log: index byte), value
+        uint64_t varints[11]  = {}; // encoded varints by their length in bytes
+        size_t   peakBytes    = 0; // largest encoded size of the log
+
+        double bytes_per_entry() const {
+            return encoded ? (double)(fields[0] + fields[1] + fields[2]) / encoded : 0;
+        }
+        double bytes_per_entry(size_t field) const {
+            return encoded ? (double)fields[field] / encoded : 0;
+        }
+    };
+    struct OpStats {
+        uint64_t count   = 0;
+        double   seconds = 0; // in total
+        double   max     = 0; // the slowest one
+    };
+    struct Stats {
+        uint64_t steps = 0;
+        OpStats  sync, stepBack; // sync counts the ones of step_back as well
+        LogStats mem, reg;
+    };
+    // A snapshot of the counters, cheap enough to be polled from a monitoring thread meanwhile
+    template <bool instrumented = instrument>
+    requires cpu_needs_instrumentation<instrumented>
+    Stats stats() const {
+        Stats st;
+        st.steps    = counters.steps.get();
+        st.sync     = counters.sync.get();
+        st.stepBack = counters.stepBack.get();
+        st.mem      = counters.mem.get();
+        st.reg      = counters.reg.get();
+        return st;
+    }
+
+    // The memory delta log (clk fields relative to the previous write, val fields are deltas),
+    // e.g. to merge several cores into one Timeline (see timeline.h)
+    template <bool tracking = track>
+    requires cpu_needs_tracking<tracking>
+    MemCoder& mem_log() {
+        flush_log();
+        return mc;
+    }
+    // The pc of each step that did not follow its predecessor sequentially (entry addr),
+    // at its clk; its front follows first_clk() (see prune_checkpoints())
+    template <bool tracking = track>
+    requires cpu_needs_tracking<tracking>
+    const MemCoder& jump_log() {
+        return jumps;
+    }
+
+    // Compression ratio and decompression throughput of both logs together
+    Coder::BlockStats log_block_stats() {
+        if constexpr (track)
+            flush_log();
+        auto stats = mc.block_stats();
+        auto reg   = rc.block_stats();
+        stats.blocks  += reg.blocks;
+        stats.raw     += reg.raw;
+        stats.packed  += reg.packed;
+        stats.thawed  += reg.thawed;
+        stats.seconds += reg.seconds;
+        return stats;
+    }
+
+    // The earliest clk sync() can reach
+    uint64_t first_clk() {
+        if constexpr (track)
+            flush_log();
+        uint64_t first = 0;
+        for (auto pos : {mc.front_pos(), rc.front_pos()}) {
+            if (pos.ordinal > 0)
+                first = std::max(first, pos.clk + 1);
+        }
+        // pc is known from the first jump left on (see pc_at())
+        if (jumps.front_pos().ordinal > 0 && jumps.num_elements())
+            first = std::max(first, jumps.front_pos().clk + (*jumps.begin()).clk);
+        return first;
+    }
+
+    // Snapshot memory, registers, pc and clk. Memory pages are shared with it, copy-on-write.
+    // Skipped if writes were already logged for the current clk: the snapshot has to be the
+    // state right in front of clk, as sync() would produce it.
+    // Taking a checkpoint behind endClk discards the recorded future.
+    template <bool tracking = track>
+    requires cpu_needs_tracking<tracking>
+    void checkpoint() {
+        flush_log();
+        prune_checkpoints();
+        discard_future();
+        if ((mc.num_elements() > 0 && lastMemClk >= clk) || (rc.num_elements() > 0 && lastRegClk >= clk))
+            return;
+
+        checkpoints.push_back({clk, pc, mc.back_pos(), rc.back_pos(), registers, memory.snapshot()});
+        slowClk = 0;
+    }
+
+    size_t num_checkpoints() {
+        return checkpoints.size();
+    }
+
+    // Moves through the recorded delta logs without executing: from the current state or from
+    // the closest checkpoint in front of targetClk, whichever is nearer, undo (backward) or redo
+    // (forward) logged writes. The log is kept, so the same window can be crossed again.
+    // Writes are applied in batches of whole cycles, pc follows from the jump log.
+    // Only clks past endClk are executed.
+    template <bool tracking = track>
+    requires cpu_needs_tracking<tracking>
+    void sync(uint64_t targetClk) {
+        [[maybe_unused]] auto t0 = start_timer();
+        flush_log();
+        targetClk = std::max(targetClk, first_clk());
+        prune_checkpoints();
+
+        auto dist = [targetClk](uint64_t c) { return c < targetClk ? targetClk - c : c - targetClk; };
+        auto ckpt = std::ranges::upper_bound(checkpoints, targetClk, {}, &Checkpoint::clk);
+        if (ckpt != checkpoints.begin() && dist(std::prev(ckpt)->clk) < dist(clk))
+            restore(*std::prev(ckpt));
+
+        // memory and registers are disjoint, each log is applied in its own clk order
+        uint64_t reached = std::min(targetClk, endClk);
+        if (reached < clk) {
+            undo<MemEntry>(mc, memHead, lastMemClk, reached);
+            undo<RegEntry>(rc, regHead, lastRegClk, reached);
+        } else {
+            redo<MemEntry>(mc, memHead, lastMemClk, reached);
+            redo<RegEntry>(rc, regHead, lastRegClk, reached);
+        }
+        // pc is not recorded in front of the first step, it stays there
+        if (auto at = pc_at(reached))
+            pc = *at;
+        clk     = reached;
+        nextPc  = pc;
+        nextClk = clk;
+        ownClk  = ~0ull; // writes at clk continue from the log, they start a new future
+        slowClk = 0;
+        rearm_live();
+        // compress again what the crossed window decompressed
+        mc.enforce_budget();
+        rc.enforce_budget();
+        jumps.enforce_budget();
+
+        if (clk < targetClk)
+            step(targetClk - clk);
+        if constexpr (instrument)
+            stop_timer(t0, counters.sync);
+    }
+    // Undo the writes of the last logged cycle, clk moves back to that cycle.
+    template <bool tracking = track>
+    requires cpu_needs_tracking<tracking>
     void step_back() {
-        uint64_t clkDelta;
-        uint32_t addr;
-        uint16_t val;
-        mc.decode<Coder::destr, Coder::r2l>(clkDelta, addr, val);
-        clk -= clkDelta;
-        memory[addr] -= val;
+        [[maybe_unused]] auto t0 = start_timer();
+        flush_log();
+        bool mem = memHead > mc.begin_offset();
+        bool reg = regHead > rc.begin_offset();
+        if (mem || reg)
+            sync(! reg ? lastMemClk : ! mem ? lastRegClk : std::max(lastMemClk, lastRegClk));
+        if constexpr (instrument)
+            stop_timer(t0, counters.stepBack);
+    }
+
+    // Net change of a memory word or register between two states
+    struct Change {
+        uint32_t addr;  // memory address, or register index
+        uint16_t delta; // added to the old value (memory with MemCoder::val_xor: XORed onto it)
+    };
+    struct Diff {
+        std::vector<Change> mem;  // by address; words ending up unchanged are left out
+        std::vector<Change> regs; // by register index, likewise
+    };
+    // What changed from the state sync(from) produces to the one of sync(to), folded from the
+    // logged writes in between (found through the clk index) without replaying anything.
+    template <bool tracking = track>
+    requires cpu_needs_tracking<tracking>
+    Diff diff(uint64_t from, uint64_t to) {
+        flush_log();
+        bool back = to < from;
+        if (back)
+            std::swap(from, to);
+        from = std::max(from, first_clk());
+        to   = std::min(to, endClk); // nothing is logged past endClk
+
+        std::unordered_map<uint32_t, uint16_t> mem, regs;
+        bool                                   xors = xor_log();
+        fold(mc, from, to, [&](const MemEntry& e) {
+            if (xors)
+                mem[e.addr] ^= e.val;
+            else
+                mem[e.addr] += e.val;
+        });
+        fold(rc, from, to, [&](const RegEntry& e) {
+            regs[e.idx1] += e.low_value;
+            if (e.two_regs)
+                regs[e.idx2] += e.high_value;
+        });
+        return {net(mem, back && ! xors), net(regs, back)};
+    }
+
+    // Reverse watchpoints: index the writes to memory [first, last] (see writes.h), last clamped
+    // to the memory. The index catches up with the log on the next query, reading it once from
+    // the oldest entry. False for an empty range, or one behind the memory.
+    template <bool tracking = track>
+    requires cpu_needs_tracking<tracking>
+    bool watch_writes(uint32_t first, uint32_t last) {
+        if (first > last || first > MEMORY)
+            return false;
+        writeIndex.watch(first, std::min<uint32_t>(last, MEMORY));
+        return true;
+    }
+    // Bound the index to the newest keep writes of each address (0 := unlimited)
+    template <bool tracking = track>
+    requires cpu_needs_tracking<tracking>
+    void set_watch_limit(size_t keep) {
+        writeIndex.set_limit(keep);
+    }
+    // The last logged write to a watched addr in front of clk before: its clk and log offset
+    template <bool tracking = track>
+    requires cpu_needs_tracking<tracking>
+    std::optional<WriteIndex::Write> last_write(uint32_t addr, uint64_t before) {
+        return write_index().last_before(addr & MEMORY, before);
+    }
+    // The logged writes to a watched addr at clks in [from, to), oldest first
+    template <bool tracking = track>
+    requires cpu_needs_tracking<tracking>
+    std::vector<WriteIndex::Write> write_history(uint32_t addr, uint64_t from, uint64_t to) {
+        return write_index().history(addr & MEMORY, from, to);
     }
 
+    // Live export: publish the delta logs into shared memory rings (see live.h) every clks cycles
+    // (0 := on publish_live() only), for tools tailing the run from another process. Readers never
+    // hold up step(), they lose the frames overwritten before they read them. nullptr: no export.
+    // With the async log the encoder thread publishes what it has encoded after each batch, so
+    // step() never waits for it; publish_live() flushes the log first.
+    template <bool tracking = track>
+    requires cpu_needs_tracking<tracking>
+    void set_live_export(LiveTrace<MemCoder>* mem, LiveTrace<RegCoder>* reg, uint64_t clks = 0) {
+        flush_log();
+        liveMem  = mem;
+        liveReg  = reg;
+        liveClks = clks;
+        liveClk  = clk;
+        rearm_live();
+    }
+    template <bool tracking = track>
+    requires cpu_needs_tracking<tracking>
+    bool publish_live() {
+        flush_log();
+        liveClk = clk;
+        rearm_live();
+        bool ok = ! liveMem || liveMem->publish(mc);
+        return (! liveReg || liveReg->publish(rc)) && ok;
+    }
+
+    // The handler is called directly, not through Decoded::run: decode() inlines, so it is known
+    // per opcode and inlines too.
     void execute(uint32_t inst) {
-        // DEMO
-        switch (inst >> 28) {
-            case 0x00:
-                auto dest = (inst & 0xFFFF) & MEMORY;
-                write_memory(dest, (inst >> 16) & 0xFFF);
-                break;
-        }
-        ///////
+        Decoded d = decode(inst);
+        if (d.run == &op_store)
+            op_store(*this, d);
+        else if (d.run == &op_load_imm)
+            op_load_imm(*this, d);
+        else if (d.run == &op_load_pair)
+            op_load_pair(*this, d);
     }
 
     void set_inst(uint32_t addr, uint32_t value) {
@@ -70,30 +481,611 @@ public:
     uint16_t get_memory(uint32_t addr) {
         return memory[addr & MEMORY];
     }
+    void set_register(uint8_t idx, uint16_t value) {
+        write_register(idx, value);
+        if constexpr (track)
+            flush_register();
+    }
+    uint16_t get_register(uint8_t idx) {
+        return registers[idx & (REGISTERS - 1)];
+    }
 
 private:
     static constexpr uint32_t MEMORY = (1 << (mem_bits + 1)) - 1;
+    static constexpr unsigned ADDR_BITS = mem_bits + 1; // logged addresses are masked by MEMORY
     static const uint8_t REGISTERS = 32;
-    std::array<uint16_t, MEMORY> memory{0x0000};
+    Memory memory;
     std::array<uint16_t, REGISTERS> registers {0x0000};
 
     MemCoder mc;
-    uint64_t lastMemClk = 0;
-    uint64_t lastRegClk = 0;
+    size_t   memHead     = 0; // offset in mc of the first write not applied to memory (redo cursor)
+    uint64_t lastMemClk  = 0; // absolute clk of the last write applied to memory
+    RegCoder rc;
+    size_t   regHead     = 0;
+    uint64_t lastRegClk  = 0;
+    uint64_t endClk      = 0;     // the logs hold all writes in front of endClk
+    bool     headsBehind = false; // writes were logged past memHead and regHead (see flush_log())
+
+    // A register write held back within a cycle, to be fused with a write to its pair register.
+    bool     regPending = false;
+    uint8_t  pendingIdx;
+    uint16_t pendingDelta;
+
+    // pc wherever it does not follow from clk: one entry (clk delta, pc as addr) per step that
+    // did not continue at the previous pc + 1 and clk + 1 (pc or clk assigned in between), and for
+    // the first one. Under the log budget, and trimmed along with the delta logs (see
+    // prune_checkpoints()).
+    MemCoder jumps;
+    uint32_t nextPc  = 0; // pc of a sequential next step
+    uint64_t nextClk = 0; // and its clk
+
+    // step() skips begin_step() while pc and clk run sequentially and clk is below slowClk: no
+    // checkpoint due (0 := check on the next step). Writes growing the logs past ckptMark bring
+    // it forward for the byte interval.
+    uint64_t slowClk  = 0;
+    size_t   ckptMark = SIZE_MAX;
+    // clk of the writes the current execution logged last: further writes in that cycle do not
+    // discard them as a future.
+    uint64_t ownClk = ~0ull;
+
+    struct Checkpoint {
+        uint64_t   clk;
+        uint32_t   pc;
+        Coder::Pos log;    // end of mc when taken
+        Coder::Pos regLog; // end of rc when taken
+        std::array<uint16_t, REGISTERS> registers;
+        typename Memory::Snapshot pages; // shared with memory and the other checkpoints
+    };
+    std::deque<Checkpoint> checkpoints;
+    size_t                 dropped = 0; // checkpoints dropped since the memory released snapshots
+    uint64_t ckptClks  = 0;
+    size_t   ckptBytes = 0;
+
+    WriteIndex writeIndex;
+
+    LiveTrace<MemCoder>* liveMem  = nullptr;
+    LiveTrace<RegCoder>* liveReg  = nullptr;
+    uint64_t             liveClks = 0;
+    uint64_t             liveClk  = 0; // of the last publish
+    uint64_t             liveDue  = ~0ull; // step() publishes from this clk on (see rearm_live())
+
+    // A write on its way to the background encoder. Register entries carry deltas already fused.
+    struct Write {
+        uint64_t clk;
+        uint32_t addr; // memory address, or idx1 of a register entry
+        uint16_t old;  // memory: the old value, register pair: the high word delta
+        uint16_t val;  // memory: the new value, register: the (low word) delta
+        enum : uint8_t { mem, reg, reg_pair, stop } kind;
+    };
+    static constexpr size_t RING = 4096;
+    struct Pipe {
+        Ring<Write, RING>     ring;
+        std::atomic<uint64_t> pushed{0};   // the encoder sleeps on it while the ring is empty
+        std::atomic<uint64_t> encoded{0};  // writes taken from the ring and encoded
+        std::atomic<size_t>   logBytes{0}; // end offsets of both logs, as of the last batch
+        PipeStats             stats;       // emulation thread only
+        std::thread           thread;
+    };
+    std::unique_ptr<Pipe> pipe;
+
+    // Instrumentation counter: each one is written by a single thread at a time (the emulation
+    // or the encoder thread) and read by any, so plain relaxed loads and stores do.
+    template <typename T>
+    class Counter {
+    public:
+        void add(T n) {
+            v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        }
+        void max(T n) {
+            if (n > v.load(std::memory_order_relaxed))
+                v.store(n, std::memory_order_relaxed);
+        }
+        T get() const {
+            return v.load(std::memory_order_relaxed);
+        }
+
+    private:
+        std::atomic<T> v{0};
+    };
+    struct LogCounters {
+        Counter<uint64_t> encoded, decoded, fields[3], varints[11];
+        Counter<size_t>   peakBytes;
+
+        LogStats get() const {
+            LogStats st{encoded.get(), decoded.get(), {}, {}, peakBytes.get()};
+            for (size_t i = 0; i < 3; ++i)
+                st.fields[i] = fields[i].get();
+            for (size_t i = 0; i < 11; ++i)
+                st.varints[i] = varints[i].get();
+            return st;
+        }
+    };
+    struct OpCounters {
+        Counter<uint64_t> count;
+        Counter<double>   seconds, max;
+
+        OpStats get() const {
+            return {count.get(), seconds.get(), max.get()};
+        }
+    };
+    struct Counters {
+        Counter<uint64_t> steps;
+        OpCounters        sync, stepBack;
+        LogCounters       mem, reg;
+    };
+    struct Empty {};
+    [[no_unique_address]] std::conditional_t<instrument, Counters, Empty> counters;
+
+    using Time = std::chrono::steady_clock::time_point;
+    static Time start_timer() {
+        if constexpr (instrument)
+            return std::chrono::steady_clock::now();
+        return {};
+    }
+    static void stop_timer(Time t0, OpCounters& op) {
+        double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        op.count.add(1);
+        op.seconds.add(s);
+        op.max.max(s);
+    }
+    // An encoded entry of the given field lengths, the log now holds size bytes. indexByte: the
+    // register log's addr field is a plain byte, not a varint.
+    static void tally(LogCounters& log, std::array<uint8_t, 3> fields, size_t size, bool indexByte) {
+        log.encoded.add(1);
+        for (size_t i = 0; i < 3; ++i) {
+            log.fields[i].add(fields[i]);
+            if (fields[i] && ! (indexByte && i == 1))
+                log.varints[fields[i]].add(1);
+        }
+        log.peakBytes.max(size);
+    }
 
     uint32_t fetch() {
-        return (memory[pc] << 16) | memory[pc+1];
+        return (memory[pc & MEMORY] << 16) | memory[(pc+1) & MEMORY];
+    }
+
+    // An instruction with its operands extracted and the handler of its op, as the block cache
+    // holds it: running it is one indirect call, no decoding and no switch.
+    struct Decoded {
+        void (*run)(Cpu_t&, const Decoded&);
+        uint8_t  idx;  // register
+        uint16_t imm;  // immediate value
+        uint32_t addr; // memory operand
+    };
+    static Decoded decode(uint32_t inst) {
+        // DEMO
+        switch (inst >> 28) {
+            case 0x00: // mem[imm16] := imm12
+                return {&op_store, 0, (uint16_t)((inst >> 16) & 0xFFF), (inst & 0xFFFF) & MEMORY};
+            case 0x01: // reg[idx] := imm16
+                return {&op_load_imm, (uint8_t)((inst >> 16) & 0x1F), (uint16_t)(inst & 0xFFFF), 0};
+            case 0x02: // reg pair[idx] := mem[imm16], mem[imm16+1] (idx is the low word)
+                return {&op_load_pair, (uint8_t)((inst >> 16) & 0x1F), 0, inst & 0xFFFF};
+        }
+        return {&op_nop, 0, 0, 0};
+        ///////
+    }
+    void run(const Decoded& inst) {
+        inst.run(*this, inst);
+    }
+    static void op_store(Cpu_t& c, const Decoded& inst) {
+        c.write_memory(inst.addr, inst.imm);
+    }
+    static void op_load_imm(Cpu_t& c, const Decoded& inst) {
+        c.write_register(inst.idx, inst.imm);
+    }
+    static void op_load_pair(Cpu_t& c, const Decoded& inst) {
+        c.write_register(inst.idx, c.get_memory(inst.addr + 1));
+        c.write_register(RegCoder::decode_idx2(inst.idx), c.get_memory(inst.addr));
+    }
+    static void op_nop(Cpu_t&, const Decoded&) {}
+
+    // The block cache: the instructions at the BLOCK pcs of an aligned block, decoded (pc runs
+    // sequentially, so a block holds the next BLOCK steps). Direct mapped by block number,
+    // tagged with it (NONE: empty). A block is dropped by writes to any word its instructions
+    // read, whether by the program, set_inst() or the undo/redo of sync() (see apply()), and
+    // all of them by restoring a checkpoint.
+    static constexpr uint32_t BLOCK  = 32; // divides the page size
+    static constexpr size_t   BLOCKS = 128;
+    static constexpr uint32_t NONE   = ~0u;
+    struct Block {
+        uint32_t                    tag = NONE;
+        std::array<Decoded, BLOCK> ops;
+    };
+    std::vector<Block> blocks = std::vector<Block>(predecode ? BLOCKS : 0);
+
+    // The block holding the instruction at pc at (masked), decoded on a miss
+    const Block& block(uint32_t at) {
+        Block& b = blocks[at / BLOCK % BLOCKS];
+        if (b.tag != at / BLOCK) {
+            // a block lies within a page, only the low word of its last instruction may not
+            uint32_t first = at / BLOCK * BLOCK;
+            auto     words = memory.words(first);
+            for (uint32_t i = 0; i < BLOCK - 1; ++i)
+                b.ops[i] = decode((words[i] << 16) | words[i + 1]);
+            b.ops[BLOCK - 1] = decode((words[BLOCK - 1] << 16) | memory[(first + BLOCK) & MEMORY]);
+            b.tag = at / BLOCK;
+        }
+        return b;
+    }
+    // Drop the cached blocks holding an instruction that addr is a word of
+    void invalidate([[maybe_unused]] uint32_t addr) {
+        if constexpr (predecode) {
+            for (uint32_t at : {addr, (addr - 1) & MEMORY}) {
+                if (blocks[at / BLOCK % BLOCKS].tag == at / BLOCK)
+                    blocks[at / BLOCK % BLOCKS].tag = NONE;
+            }
+        }
     }
 
     void write_memory(uint32_t addr, uint16_t value) {
+        addr &= MEMORY;
+        invalidate(addr);
+        if constexpr (track) {
+            discard_future();
+            if (pipe) {
+                push({clk, addr, memory[addr], value, Write::mem});
+            } else {
+                encode_memory(clk - lastMemClk, addr, val_delta(memory[addr], value));
+                if (ckptMark != SIZE_MAX) [[unlikely]]
+                    check_log_bytes();
+            }
+            headsBehind = true;
+            ownClk      = clk;
+            lastMemClk  = clk;
+            endClk      = std::max(endClk, clk + 1);
+        }
+        memory.at(addr) = value;
+    }
+
+    // Low and high word of a register pair written in the same cycle share one two-reg entry.
+    void write_register(uint8_t idx, uint16_t value) {
+        idx &= REGISTERS - 1;
         if constexpr (track) {
-            auto clkDelta = clk - lastMemClk;
-            auto valDelta = value - memory[addr];
+            discard_future();
+            uint16_t valDelta = value - registers[idx];
+
+            if (regPending && RegCoder::decode_idx2(pendingIdx) == idx) {
+                encode_register<true>(pendingIdx, valDelta, pendingDelta);
+            } else if (regPending && RegCoder::decode_idx2(idx) == pendingIdx) {
+                encode_register<true>(idx, pendingDelta, valDelta);
+            } else {
+                flush_register();
+                regPending   = true;
+                pendingIdx   = idx;
+                pendingDelta = valDelta;
+            }
+        }
+        registers[idx] = value;
+    }
+
+    void flush_register() {
+        if (regPending)
+            encode_register<false>(pendingIdx, 0, pendingDelta);
+    }
+
+    template <bool two>
+    void encode_register(uint8_t idx1, uint16_t highDelta, uint16_t lowDelta) {
+        if (pipe) {
+            push({clk, idx1, highDelta, lowDelta, two ? Write::reg_pair : Write::reg});
+        } else {
+            encode_register_entry<two>(clk - lastRegClk, idx1, highDelta, lowDelta);
+            if (ckptMark != SIZE_MAX) [[unlikely]]
+                check_log_bytes();
+        }
+        headsBehind = true;
+        ownClk      = clk;
+        regPending  = false;
+        lastRegClk  = clk;
+        endClk      = std::max(endClk, clk + 1);
+    }
+
+    // The bookkeeping in front of a step that does not continue sequentially, or once slowClk is
+    // reached: discard the future, checkpoint, log the jump.
+    void begin_step() {
+        discard_future();
+        auto_checkpoint();
+        if (pc != nextPc || clk != nextClk || ! jumps.num_elements())
+            jumps.encode(clk - jumps.back_pos().clk, pc, 0);
+        rearm_live();
+    }
+
+    void auto_checkpoint() {
+        auto last = [this](size_t& offs) {
+            offs = checkpoints.empty() ? 0 : checkpoints.back().log.offset + checkpoints.back().regLog.offset;
+            return checkpoints.empty() ? 0 : checkpoints.back().clk;
+        };
+        size_t   lastOffs;
+        uint64_t lastClk = last(lastOffs);
+        // the encoder thread owns the logs, it publishes their size after each batch
+        size_t logBytes = pipe ? pipe->logBytes.load(std::memory_order_relaxed) : mc.end_offset() + rc.end_offset();
+        if ((ckptClks && clk - lastClk >= ckptClks) || (ckptBytes && logBytes - lastOffs >= ckptBytes)) {
+            checkpoint();
+            lastClk = last(lastOffs);
+        }
+        // when the next one is due; the log size of the encoder thread is only known per step
+        slowClk  = ckptClks ? lastClk + ckptClks : ~0ull;
+        ckptMark = ckptBytes && ! pipe ? lastOffs + ckptBytes : SIZE_MAX;
+        if (ckptBytes && pipe)
+            slowClk = std::min(slowClk, clk + 1);
+    }
 
-            mc.encode(clkDelta, addr, valDelta);
+    void check_log_bytes() {
+        if (mc.end_offset() + rc.end_offset() >= ckptMark)
+            slowClk = 0;
+    }
+
+    // After clk or the live export settings changed. A publish behind clk (rewound) is due at once.
+    void rearm_live() {
+        liveDue = ! liveClks || pipe ? ~0ull : clk < liveClk ? clk : liveClk + liveClks;
+    }
+
+    // Pages are shared with the checkpoint again (copy-on-write), only the pages changed in
+    // between are put back.
+    void restore(const Checkpoint& ckpt) {
+        memory.restore(ckpt.pages);
+        for (Block& b : blocks)
+            b.tag = NONE;
+        registers  = ckpt.registers;
+        pc         = ckpt.pc;
+        clk        = ckpt.clk;
+        memHead    = ckpt.log.offset;
+        lastMemClk = ckpt.log.clk;
+        regHead    = ckpt.regLog.offset;
+        lastRegClk = ckpt.regLog.clk;
+    }
+
+    template <Coder::dir_t V>
+    size_t read(MemCoder& log, std::span<MemEntry> out) {
+        return log.decode_batch<Coder::non_destr, V, ADDR_BITS>(out);
+    }
+    template <Coder::dir_t V>
+    size_t read(RegCoder& log, std::span<RegEntry> out) {
+        return log.decode_batch<Coder::non_destr, V>(out);
+    }
+
+    // The log encodes, on the emulation thread or the encoder thread (see set_async_log())
+    void encode_memory(uint64_t clkDelta, uint32_t addr, uint16_t valDelta) {
+        [[maybe_unused]] std::array<uint8_t, 3> fields;
+        if constexpr (instrument)
+            fields = mc.layout(clkDelta, addr, valDelta);
+        mc.encode<ADDR_BITS>(clkDelta, addr, valDelta);
+        if constexpr (instrument)
+            tally(counters.mem, fields, mc.get_size(), false);
+    }
+    template <bool two>
+    void encode_register_entry(uint64_t clkDelta, uint8_t idx1, uint16_t highDelta, uint16_t lowDelta) {
+        if constexpr (two)
+            rc.encode(clkDelta, idx1, highDelta, lowDelta);
+        else
+            rc.encode(clkDelta, idx1, lowDelta);
+        if constexpr (instrument)
+            tally(counters.reg, RegCoder::layout(clkDelta, highDelta, lowDelta), rc.get_size(), true);
+    }
+
+    bool xor_log() {
+        return mc.get_mode() & MemCoder::val_xor;
+    }
+    uint16_t val_delta(uint16_t old, uint16_t value) {
+        return xor_log() ? value ^ old : value - old;
+    }
+
+    // Hand a write to the encoder thread, waiting while the ring is full.
+    void push(const Write& w) {
+        if (! pipe->ring.push(w)) {
+            ++pipe->stats.stalls;
+            do {
+                std::this_thread::yield();
+            } while (! pipe->ring.push(w));
+        }
+        pipe->pushed.fetch_add(1, std::memory_order_release);
+        pipe->pushed.notify_one();
+        pipe->stats.peak = std::max(pipe->stats.peak, pipe->ring.size());
+    }
+
+    void encode_loop() {
+        std::array<Write, 256> batch;
+        bool stop = false;
+        while (! stop) {
+            uint64_t seen = pipe->pushed.load(std::memory_order_acquire);
+            size_t   n    = pipe->ring.pop(batch);
+            if (n == 0) {
+                pipe->pushed.wait(seen, std::memory_order_acquire);
+                continue;
+            }
+            for (auto& w : std::span(batch).first(n)) {
+                switch (w.kind) {
+                    case Write::mem:
+                        encode_memory(w.clk - mc.back_pos().clk, w.addr, val_delta(w.old, w.val));
+                        break;
+                    case Write::reg:
+                        encode_register_entry<false>(w.clk - rc.back_pos().clk, w.addr, 0, w.val);
+                        break;
+                    case Write::reg_pair:
+                        encode_register_entry<true>(w.clk - rc.back_pos().clk, w.addr, w.old, w.val);
+                        break;
+                    case Write::stop:
+                        stop = true;
+                        break;
+                }
+            }
+            pipe->logBytes.store(mc.end_offset() + rc.end_offset(), std::memory_order_relaxed);
+            publish_encoded();
+            pipe->encoded.fetch_add(n, std::memory_order_release);
+            pipe->encoded.notify_one();
+        }
+    }
+
+    // Live export on the encoder thread, up to its last batch. liveClk is only touched by the
+    // emulation thread behind flush_log() meanwhile.
+    void publish_encoded() {
+        uint64_t at = std::max(mc.back_pos().clk, rc.back_pos().clk);
+        if (! liveClks || at < liveClk + liveClks)
+            return;
+        liveClk = at;
+        if (liveMem)
+            liveMem->publish(mc);
+        if (liveReg)
+            liveReg->publish(rc);
+    }
+
+    void apply(const MemEntry& e, bool revert) {
+        invalidate(e.addr);
+        if (xor_log())
+            memory.at(e.addr) ^= e.val;
+        else
+            memory.at(e.addr) += revert ? -e.val : e.val;
+    }
+    void apply(const RegEntry& e, bool revert) {
+        registers[e.idx1] += revert ? -e.low_value : e.low_value;
+        if (e.two_regs)
+            registers[e.idx2] += revert ? -e.high_value : e.high_value;
+    }
+
+    // f(e) for the entries of log written at clks in [from, to)
+    template <typename C, typename F>
+    static void fold(C& log, uint64_t from, uint64_t to, F f) {
+        if (from >= to)
+            return;
+        Coder::Pos pos = log.find(from);
+        uint64_t   clk = pos.clk;
+        for (typename C::iterator it(&log, pos), end = log.end(); it != end; ++it) {
+            auto e = *it;
+            if ((clk += e.clk) >= to)
+                break;
+            f(e);
+        }
+    }
+    // The non-zero deltas of m, sorted (negated: the change from the newer to the older state)
+    static std::vector<Change> net(const std::unordered_map<uint32_t, uint16_t>& m, bool negate) {
+        std::vector<Change> out;
+        for (auto [addr, delta] : m) {
+            if (delta)
+                out.push_back({addr, negate ? (uint16_t)-delta : delta});
+        }
+        std::ranges::sort(out, {}, &Change::addr);
+        return out;
+    }
+
+    // Revert applied entries of a log from clk targetClk onwards, head is the log's redo cursor.
+    template <typename E, typename C>
+    void undo(C& log, size_t& head, uint64_t& lastClk, uint64_t targetClk) {
+        replay<Coder::r2l, E>(log, head, [&](const E& e) {
+            if (lastClk < targetClk)
+                return false;
+            lastClk -= e.clk;
+            apply(e, true);
+            return true;
+        });
+    }
+
+    // Re-apply logged entries in front of clk targetClk.
+    template <typename E, typename C>
+    void redo(C& log, size_t& head, uint64_t& lastClk, uint64_t targetClk) {
+        replay<Coder::l2r, E>(log, head, [&](const E& e) {
+            if (lastClk + e.clk >= targetClk)
+                return false;
+            lastClk += e.clk;
+            apply(e, false);
+            return true;
+        });
+    }
+
+    // f(e) for the entries from head on in direction V, until it returns false; head moves behind
+    // the last accepted one. The entries are decoded in growing batches (the writes of one cycle
+    // are adjacent, so they go together); a batch reaching past the last one gets decoded up to it
+    // again to place the cursor, as decode_batch() yields no per-entry offsets.
+    template <Coder::dir_t V, typename E, typename C, typename F>
+    void replay(C& log, size_t& head, F f) {
+        std::array<E, 256> batch;
+        size_t             want = 4;
+        log.seek(V, head);
+        for (bool more = true; more; want = std::min(2 * want, batch.size())) {
+            auto   got = std::span(batch).first(read<V>(log, std::span(batch).first(want)));
+            size_t n   = 0;
+            while (n < got.size() && f(got[n]))
+                ++n;
+            if constexpr (instrument)
+                (std::is_same_v<E, MemEntry> ? counters.mem : counters.reg).decoded.add(got.size());
+            more = n == want;
+            if (n < got.size()) {
+                log.seek(V, head);
+                read<V>(log, std::span(batch).first(n));
+            }
+            head = log.tell(V);
+        }
+    }
+
+    // pc at clk: the last jump logged in front of it, continued sequentially. None in front of the
+    // first jump.
+    std::optional<uint32_t> pc_at(uint64_t at) {
+        if (! jumps.num_elements())
+            return {};
+        Coder::Pos         pos = jumps.find(at + 1);
+        MemCoder::iterator it(&jumps, pos);
+        if (pos.ordinal == jumps.front_pos().ordinal)
+            pos = it.pos();
+        else
+            pos = (--it).pos();
+        MemEntry j = *it;
+        if (at < pos.clk + j.clk)
+            return {}; // in front of the first jump: a preset clk, nothing ran there
+        return j.addr + (uint32_t)(at - (pos.clk + j.clk));
+    }
+
+    const WriteIndex& write_index() {
+        flush_log();
+        writeIndex.update(mc);
+        return writeIndex;
+    }
+
+    // Executing behind endClk starts a new future: drop the logged one and its checkpoints.
+    void discard_future() {
+        if (clk < endClk && clk != ownClk) [[unlikely]]
+            drop_future();
+    }
+    void drop_future() {
+        flush_log();
+        Coder::Pos memEnd = mc.truncate(memHead);
+        Coder::Pos regEnd = rc.truncate(regHead);
+        writeIndex.truncate(memEnd);
+        if (liveMem)
+            liveMem->truncate(memEnd);
+        if (liveReg)
+            liveReg->truncate(regEnd);
+        jumps.truncate(jumps.find(clk).offset);
+        if (pipe)
+            pipe->logBytes = mc.end_offset() + rc.end_offset();
+        drop_checkpoints(clk);
+        endClk  = clk;
+        slowClk = 0;
+    }
+
+    // Checkpoints whose log positions got evicted by the log budget cannot be replayed from, the
+    // memory lets go of their pages. Finding them walks the snapshots of the checkpoints kept, so
+    // that waits until a quarter of those got dropped.
+    // The jump log is trimmed along: only the last jump at or in front of first_clk() is read again.
+    void prune_checkpoints() {
+        while (! checkpoints.empty() && (checkpoints.front().log.offset < mc.begin_offset() ||
+                                         checkpoints.front().regLog.offset < rc.begin_offset())) {
+            checkpoints.pop_front();
+            ++dropped;
+        }
+        if (dropped && dropped >= checkpoints.size() / 4) {
+            memory.release_before(checkpoints.empty() ? typename Memory::Snapshot() : checkpoints.front().pages);
+            dropped = 0;
+        }
+
+        Coder::Pos pos = jumps.find(first_clk() + 1);
+        if (pos.ordinal > jumps.front_pos().ordinal)
+            jumps.drop_before((--MemCoder::iterator(&jumps, pos)).pos().offset);
+    }
 
-            lastMemClk = clk;
+    // Checkpoints past targetClk describe a discarded future.
+    void drop_checkpoints(uint64_t targetClk) {
+        while (! checkpoints.empty() && checkpoints.back().clk > targetClk) {
+            checkpoints.pop_back();
+            ++dropped;
         }
-        memory[addr & MEMORY] = value;
     }
 };
@@ -0,0 +1,406 @@
+// Live
+// MIT License. Copyright 2023 Mirko Palmer (derbroti)
+////////
+
+// Live export of a MemCoder / RegCoder stream through a POSIX shared memory ring, for analysis
+// tools tailing the emulator from another process (LiveTrace writes, LiveReader tails).
+//
+// Shared memory layout (host byte order):
+// ---------------------------------------
+//
+// |---- 64 byte ----|---- 64 byte ----|------ capacity byte ------|-- PADDING --|
+// Header,            counters,         ring of frames,             zero bytes
+//
+// Frame:
+// ------
+//
+// |-- 8 byte --|- 8 byte -|--- 32 byte ---|--- 32 byte ---|-- bytes --|-- to 8 byte alignment --|
+// seq,          bytes,     Pos from,       Pos to,         encoded entries
+//
+// Every publish() writes the entries encoded since the previous one as frames (one per chunk,
+// split at entry boundaries into a quarter of the ring at most), never wrapping around the end of
+// the ring: the rest of the ring is skipped, marked by a frame with bytes = WRAP if there is room
+// for one.
+//
+// There is a single writer and any number of readers, the readers write nothing: the writer
+// overwrites the oldest frames whether they were read or not. It announces the ring bytes it is
+// about to overwrite (claimed) before writing them and publishes the frames (tail) afterwards; a
+// reader decodes a frame straight from the ring and checks claimed afterwards, whether the frame
+// got overwritten meanwhile (seqlock style). Then it skips to the oldest intact frame (overrun).
+//
+// A frame not starting where the previous one ended (the coder got truncated, or evicted entries
+// before they were published) tells the readers to resync at its from.
+//
+
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "coder.h"
+
+namespace live {
+
+static constexpr char     MAGIC[8] = {'C', 'O', 'D', 'E', 'R', 'L', 'I', 'V'};
+static constexpr uint32_t VERSION  = 1;
+static constexpr uint64_t WRAP     = ~0ull;
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "the counters are shared between processes");
+
+struct Header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t kind; // 1: MemCoder, 2: RegCoder
+    uint32_t mode; // the coder's field mode, taken from the first published coder
+    uint32_t reserved;
+    uint64_t capacity; // ring bytes, a power of 2
+
+    alignas(64) std::atomic<uint64_t> claimed; // ring bytes (ever written) the writer is writing up to
+    std::atomic<uint64_t>             oldest;  // the oldest frame not overwritten yet
+    std::atomic<uint64_t>             tail;    // published ring bytes, the next frame goes here
+    std::atomic<uint64_t>             seq;     // published frames
+};
+struct Frame {
+    uint64_t   seq;
+    uint64_t   bytes; // of the encoded entries, WRAP: the ring continues at its start
+    Coder::Pos from;
+    Coder::Pos to;
+};
+static_assert(std::has_unique_object_representations_v<Frame>, "frames are copied byte for byte");
+
+template <typename C>
+static constexpr uint32_t kind_of() {
+    return std::is_same_v<C, MemCoder> ? 1 : 2;
+}
+
+// Bytes of shared memory for a ring of capacity bytes
+static size_t map_size(uint64_t capacity) {
+    return sizeof(Header) + capacity + Coder::PADDING;
+}
+
+} // namespace live
+
+template <typename C>
+class LiveTrace {
+public:
+    // Creates (or replaces) the shared memory object name ("/name"), with a ring of at least
+    // capacity bytes. Check ok(). It is unlinked again on destruction, readers keep their mapping.
+    LiveTrace(const std::string& name, size_t capacity = 1 << 20): name(name) {
+        cap = std::bit_ceil(std::max<size_t>(capacity, 4096));
+        fd  = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || ::ftruncate(fd, live::map_size(cap)) != 0)
+            return;
+        void* addr = ::mmap(nullptr, live::map_size(cap), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED)
+            return;
+
+        hdr  = static_cast<live::Header*>(addr);
+        ring = reinterpret_cast<uint8_t*>(hdr + 1);
+        hdr->version  = live::VERSION;
+        hdr->kind     = live::kind_of<C>();
+        hdr->capacity = cap;
+        std::memcpy(hdr->magic, live::MAGIC, sizeof(live::MAGIC));
+        good = true;
+    }
+    ~LiveTrace() {
+        if (hdr)
+            ::munmap(hdr, live::map_size(cap));
+        if (fd >= 0) {
+            ::close(fd);
+            ::shm_unlink(name.c_str());
+        }
+    }
+    LiveTrace(const LiveTrace&)            = delete;
+    LiveTrace& operator=(const LiveTrace&) = delete;
+
+    bool ok() {
+        return good;
+    }
+    size_t capacity() {
+        return cap;
+    }
+    // Where the next publish() continues
+    Coder::Pos back_pos() {
+        return published;
+    }
+
+    // Publish the entries of c from back_pos() (the first time: from c's front) to its end.
+    // Never waits for readers. Fails if c's field mode differs from the published one.
+    // c truncated in front of back_pos() since the last publish() has to be reported through
+    // truncate() first, unless it did not grow again beyond back_pos() meanwhile.
+    bool publish(C& c) {
+        if (! good || ! adopt_mode(c))
+            return false;
+
+        Coder::Pos to = c.back_pos();
+        if (started && published.offset > to.offset && ! truncate(to))
+            return false;
+        if (! started || published.offset < c.begin_offset())
+            published = c.front_pos();
+        started = true;
+
+        std::vector<uint8_t> thawed; // a compressed chunk, decompressed for the copy only
+        for (auto& ch : c.chunks) {
+            size_t head = Coder::head_offset(ch);
+            size_t lo   = std::max(published.offset, head);
+            size_t hi   = std::min(to.offset, head + Coder::live(ch));
+            if (lo >= hi)
+                continue;
+            uint8_t* p = ch.head;
+            if (ch.frozen) {
+                thawed.resize(ch.frozen);
+                p = thawed.data();
+                Block::unpack(ch.packed, p, ch.frozen);
+            }
+            Coder::Pos end = hi == to.offset ? to : c.next(&ch)->from;
+            while (end.offset - published.offset > cap / 4) {
+                Coder::Pos cut = split(c, published);
+                if (! put_frame(published, cut, p + (published.offset - head)))
+                    return false;
+                published = cut;
+            }
+            if (! put_frame(published, end, p + (published.offset - head)))
+                return false;
+            published = end;
+        }
+        return true;
+    }
+
+    // The coder got truncated to end (see MemCoder::truncate()): readers resync there.
+    bool truncate(Coder::Pos end) {
+        if (! good || ! started || end.offset >= published.offset)
+            return good;
+        if (! put_frame(end, end, nullptr))
+            return false;
+        published = end;
+        return true;
+    }
+
+    // Published frames
+    uint64_t frames() {
+        return seq;
+    }
+
+private:
+    std::string          name;
+    int                  fd      = -1;
+    bool                 good    = false;
+    bool                 started = false; // published anything (an empty coder included)
+    uint64_t             cap     = 0;
+    live::Header*        hdr     = nullptr;
+    uint8_t*             ring    = nullptr;
+    uint64_t             tail    = 0; // ring bytes ever written
+    uint64_t             seq     = 0;
+    Coder::Pos           published{};
+    std::deque<uint64_t> starts; // of the frames not overwritten yet
+
+    bool adopt_mode(C& c) {
+        if (! started)
+            hdr->mode = c.get_mode();
+        return hdr->mode == c.get_mode();
+    }
+
+    // The last entry boundary at most a quarter of the ring behind from
+    Coder::Pos split(C& c, Coder::Pos from) {
+        Coder::Pos cut = from;
+        for (typename C::iterator it(&c, from); it.pos().offset - from.offset <= cap / 4; ++it)
+            cut = it.pos();
+        return cut;
+    }
+
+    // One frame of the entries between from and to, at data
+    bool put_frame(Coder::Pos from, Coder::Pos to, const uint8_t* data) {
+        size_t   bytes = to.offset - from.offset;
+        size_t   len   = sizeof(live::Frame) + (bytes + 7) / 8 * 8;
+        uint64_t off   = tail & (cap - 1);
+        uint64_t skip  = cap - off < len ? cap - off : 0;
+        if (len > cap)
+            return false;
+
+        uint64_t start = tail + skip;
+        uint64_t end   = start + len;
+        while (! starts.empty() && starts.front() + cap < end)
+            starts.pop_front();
+        hdr->oldest.store(starts.empty() ? start : starts.front(), std::memory_order_relaxed);
+        hdr->claimed.store(end, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        if (skip >= sizeof(live::Frame)) {
+            live::Frame wrap{seq, live::WRAP, {}, {}};
+            std::memcpy(ring + off, &wrap, sizeof(wrap));
+        }
+        live::Frame f{seq, bytes, from, to};
+        uint8_t*    p = ring + (start & (cap - 1));
+        std::memcpy(p, &f, sizeof(f));
+        if (bytes)
+            std::memcpy(p + sizeof(f), data, bytes);
+        std::memset(p + sizeof(f) + bytes, 0, len - sizeof(f) - bytes);
+
+        starts.push_back(start);
+        tail = end;
+        hdr->seq.store(++seq, std::memory_order_relaxed);
+        hdr->tail.store(tail, std::memory_order_release);
+        return true;
+    }
+};
+
+template <typename C>
+class LiveReader {
+public:
+    using Entry = std::conditional_t<std::is_same_v<C, MemCoder>, MemEntry, RegEntry>;
+
+    // How the entries of a read() continue the stream
+    enum status_t {
+        empty,   // nothing new
+        next,    // right where the previous read() ended
+        resync,  // at start(): the first read, or the writer truncated or skipped entries
+        overrun, // at start(): the writer overwrote frames not read yet, they are lost
+    };
+
+    // Maps the shared memory object of a LiveTrace read-only. Check ok(). Reading starts at the
+    // oldest frame still in the ring.
+    LiveReader(const std::string& name) {
+        fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0)
+            return;
+        // the header first, it tells the size of the ring
+        void* addr = ::mmap(nullptr, sizeof(live::Header), PROT_READ, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED)
+            return;
+        auto* h = static_cast<const live::Header*>(addr);
+        if (std::equal(live::MAGIC, live::MAGIC + sizeof(live::MAGIC), h->magic) && h->version == live::VERSION &&
+            h->kind == live::kind_of<C>() && std::has_single_bit(h->capacity))
+            cap = h->capacity;
+        ::munmap(addr, sizeof(live::Header));
+        if (! cap)
+            return;
+        addr = ::mmap(nullptr, live::map_size(cap), PROT_READ, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED) {
+            cap = 0;
+            return;
+        }
+
+        hdr  = static_cast<const live::Header*>(addr);
+        ring = reinterpret_cast<const uint8_t*>(hdr + 1);
+        at   = hdr->oldest.load(std::memory_order_acquire);
+        good = true;
+    }
+    ~LiveReader() {
+        if (hdr)
+            ::munmap(const_cast<live::Header*>(hdr), live::map_size(cap));
+        if (fd >= 0)
+            ::close(fd);
+    }
+    LiveReader(const LiveReader&)            = delete;
+    LiveReader& operator=(const LiveReader&) = delete;
+
+    bool ok() {
+        return good;
+    }
+
+    // Decode the entries published since the last read() into out (clk fields as stored,
+    // relative to the previous entry), as far as they continue each other. Decodes in place from
+    // the ring, without locking it.
+    status_t read(std::vector<Entry>& out) {
+        out.clear();
+        status_t status = empty;
+        uint64_t tail   = hdr->tail.load(std::memory_order_acquire);
+        while (at < tail) {
+            uint64_t off = at & (cap - 1);
+            if (cap - off < sizeof(live::Frame)) {
+                at += cap - off;
+                continue;
+            }
+            live::Frame f;
+            std::memcpy(&f, ring + off, sizeof(f));
+            size_t n    = out.size();
+            bool   sane = f.bytes == live::WRAP ||
+                        (f.bytes <= cap - off - sizeof(f) && f.to.offset - f.from.offset == f.bytes);
+            if (sane && f.bytes != live::WRAP)
+                decode(ring + off + sizeof(f), f, out);
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (hdr->claimed.load(std::memory_order_relaxed) > at + cap || ! sane) {
+                // overwritten while (or before) decoding it
+                out.resize(n);
+                if (status != empty)
+                    return status;
+                at     = hdr->oldest.load(std::memory_order_acquire);
+                tail   = hdr->tail.load(std::memory_order_acquire);
+                lapped = true;
+                continue;
+            }
+            if (f.bytes == live::WRAP) {
+                at += cap - off;
+                continue;
+            }
+
+            bool cont = begun && ! lapped && f.from.offset == last.offset && f.from.ordinal == last.ordinal;
+            if (status != empty && ! cont) {
+                out.resize(n);
+                return status;
+            }
+            if (status == empty) {
+                status = lapped ? overrun : cont ? next : resync;
+                first  = f.from;
+                if (begun)
+                    lost += f.seq - expect;
+            }
+            last   = f.to;
+            expect = f.seq + 1;
+            begun  = true;
+            lapped = false;
+            at += sizeof(f) + (f.bytes + 7) / 8 * 8;
+        }
+        return status;
+    }
+
+    // The stream position in front of the entries of the last read(), and behind them
+    Coder::Pos start() {
+        return first;
+    }
+    Coder::Pos pos() {
+        return last;
+    }
+    // Frames overwritten before they could be read
+    uint64_t lost_frames() {
+        return lost;
+    }
+
+private:
+    int                 fd     = -1;
+    bool                good   = false;
+    uint64_t            cap    = 0;
+    const live::Header* hdr    = nullptr;
+    const uint8_t*      ring   = nullptr;
+    uint64_t            at     = 0; // ring bytes (ever written) read
+    bool                begun  = false;
+    bool                lapped = false; // skipped to the oldest frame, the next one starts an overrun
+    uint64_t            expect = 0;     // seq of the next frame
+    uint64_t            lost   = 0;
+    Coder::Pos          first{};
+    Coder::Pos          last{};
+    C                   codec{64}; // decodes in the published field mode, holds no entries
+
+    void decode(const uint8_t* data, const live::Frame& f, std::vector<Entry>& out) {
+        uint8_t*       p   = const_cast<uint8_t*>(data);
+        const uint8_t* end = data + f.bytes;
+        if constexpr (std::is_same_v<C, MemCoder>) {
+            if (codec.get_mode() != hdr->mode)
+                codec.set_mode(hdr->mode);
+            uint32_t ctx = f.from.addr;
+            while (p < end)
+                p = codec.get_entry(p, end, out.emplace_back(), ctx);
+        } else {
+            while (p < end)
+                p = C::get_entry(p, end, out.emplace_back());
+        }
+    }
+};
@@ -0,0 +1,254 @@
+// Pages
+// MIT License. Copyright 2023 Mirko Palmer (derbroti)
+////////
+
+// Sparse, page-granular memory of WORDS 16 bit words.
+//
+// A page is allocated on its first write, until then it reads as zeros (the shared zero page).
+// Snapshots share the pages copy-on-write: the dirty bitmap marks the pages written since the last
+// snapshot() or restore(), only those are owned exclusively and written in place.
+// A snapshot holds just the pages dirtied since the one before it (old and new page pointer) and
+// links back to that one. Taking a snapshot costs the dirty pages, restoring one the pages
+// changed between it and the current state; neither copies words nor walks the whole table.
+// Accesses go through plain pointer tables next to the page pointers: a read is one lookup, a
+// write to a dirty page one lookup and a null check. Without a live snapshot pages stay dirty
+// once written, so that is all memory costs over a flat array then.
+//
+
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cassert>
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <ranges>
+#include <span>
+#include <utility>
+#include <vector>
+
+template <size_t WORDS, size_t PAGE>
+requires (std::has_single_bit(WORDS) && std::has_single_bit(PAGE) && PAGE <= WORDS)
+class PagedMemory {
+public:
+    static constexpr size_t PAGES = WORDS / PAGE;
+    using Page = std::array<uint16_t, PAGE>;
+
+private:
+    using PagePtr = std::shared_ptr<const Page>;
+    struct Change {
+        size_t  page;
+        PagePtr before; // in the previous snapshot
+        PagePtr after;  // in this one
+    };
+    struct Delta {
+        // cut by release_before() once nothing restores across it
+        mutable std::shared_ptr<const Delta> prev;
+        size_t                               depth; // snapshots in front of this one
+        std::vector<Change>                  changes;
+
+        // unlinks a long chain in a loop instead of one nested destructor per delta
+        ~Delta() {
+            for (auto p = std::move(prev); p && p.use_count() == 1;)
+                p = std::move(p->prev);
+        }
+    };
+
+public:
+    using Snapshot = std::shared_ptr<const Delta>;
+
+    PagedMemory()
+    : table(PAGES, zero_page()), view(PAGES, zero_page()->data()), own(PAGES), base(std::make_shared<const Delta>()) {}
+
+    uint16_t operator[](size_t addr) const {
+        return view[addr / PAGE][addr % PAGE];
+    }
+    // The words from addr to the end of its page, for reading
+    std::span<const uint16_t> words(size_t addr) const {
+        return {view[addr / PAGE] + addr % PAGE, PAGE - addr % PAGE};
+    }
+    // The word at addr for writing: its page becomes dirty, and gets copied first if shared.
+    uint16_t& at(size_t addr) {
+        if (uint16_t* p = own[addr / PAGE]) [[likely]]
+            return p[addr % PAGE];
+        return make_dirty(addr / PAGE)[addr % PAGE];
+    }
+
+    // Share all pages with the returned snapshot, none is dirty afterwards.
+    Snapshot snapshot() {
+        if (written.empty())
+            return base;
+        std::vector<Change> changes;
+        changes.reserve(written.size());
+        for (auto& [i, before] : written)
+            changes.push_back({i, std::move(before), table[i]});
+        clear_dirty();
+        base = std::make_shared<const Delta>(base, base->depth + 1, std::move(changes));
+        return base;
+    }
+    // Take over the pages of snap: the dirty pages go back to the last snapshot, then the deltas
+    // between it and snap are undone up to their common predecessor and redone down to snap.
+    void restore(const Snapshot& snap) {
+        for (auto& [i, before] : written)
+            set(i, std::move(before));
+        clear_dirty();
+
+        std::vector<const Delta*> redo;
+        const Delta* from = base.get();
+        const Delta* to   = snap.get();
+        while (from != to) {
+            assert(from && to); // snap was not released
+            if (from->depth >= to->depth) {
+                for (auto& c : from->changes | std::views::reverse)
+                    set(c.page, c.before);
+                from = from->prev.get();
+            } else {
+                redo.push_back(to);
+                to = to->prev.get();
+            }
+        }
+        for (const Delta* d : redo | std::views::reverse) {
+            for (auto& c : d->changes)
+                set(c.page, c.after);
+        }
+        base = snap;
+    }
+    // Snapshots in front of oldest (and of the current state) will not be restored anymore:
+    // unlink them, so their pages can be freed. Without oldest, only the current state is kept.
+    void release_before(const Snapshot& oldest = {}) {
+        const Delta* a = base.get();
+        const Delta* b = oldest ? oldest.get() : a;
+        while (a != b) {
+            if (a->depth >= b->depth)
+                a = a->prev.get();
+            else
+                b = b->prev.get();
+        }
+        a->prev.reset();
+    }
+    bool is_dirty(size_t page) const {
+        return dirty[page / 64] >> page % 64 & 1;
+    }
+    // f(page) for every dirty page, in order; scales with the bitmap, not the words
+    template <typename F>
+    void for_each_dirty(F f) const {
+        for (size_t w = 0; w < dirty.size(); ++w) {
+            for (uint64_t bits = dirty[w]; bits; bits &= bits - 1)
+                f(w * 64 + std::countr_zero(bits));
+        }
+    }
+    // Pages holding their own words (not the zero page)
+    size_t resident_pages() const {
+        size_t n = 0;
+        for (auto& p : table)
+            n += p != zero_page();
+        return n;
+    }
+
+    // All words, as a random access range
+    class iterator {
+    public:
+        using value_type      = uint16_t;
+        using difference_type = std::ptrdiff_t;
+
+        iterator() = default;
+        iterator(const PagedMemory* mem, size_t addr) : mem(mem), addr(addr) {}
+
+        uint16_t operator*() const {
+            return (*mem)[addr];
+        }
+        uint16_t operator[](difference_type n) const {
+            return (*mem)[addr + n];
+        }
+        iterator& operator++() {
+            ++addr;
+            return *this;
+        }
+        iterator operator++(int) {
+            return {mem, addr++};
+        }
+        iterator& operator--() {
+            --addr;
+            return *this;
+        }
+        iterator operator--(int) {
+            return {mem, addr--};
+        }
+        iterator& operator+=(difference_type n) {
+            addr += n;
+            return *this;
+        }
+        iterator& operator-=(difference_type n) {
+            addr -= n;
+            return *this;
+        }
+        friend iterator operator+(iterator it, difference_type n) {
+            return it += n;
+        }
+        friend iterator operator+(difference_type n, iterator it) {
+            return it += n;
+        }
+        friend iterator operator-(iterator it, difference_type n) {
+            return it -= n;
+        }
+        friend difference_type operator-(const iterator& a, const iterator& b) {
+            return (difference_type)a.addr - (difference_type)b.addr;
+        }
+        bool operator==(const iterator& o) const {
+            return addr == o.addr;
+        }
+        auto operator<=>(const iterator& o) const {
+            return addr <=> o.addr;
+        }
+
+    private:
+        const PagedMemory* mem  = nullptr;
+        size_t             addr = 0;
+    };
+    iterator begin() const {
+        return {this, 0};
+    }
+    iterator end() const {
+        return {this, WORDS};
+    }
+    static constexpr size_t size() {
+        return WORDS;
+    }
+
+private:
+    std::vector<PagePtr>                    table;
+    std::vector<const uint16_t*>            view; // the words of table[i]
+    std::vector<uint16_t*>                  own;  // them again if the page is dirty, else nullptr
+    std::array<uint64_t, (PAGES + 63) / 64> dirty{};
+    std::vector<std::pair<size_t, PagePtr>> written; // dirty pages and their pointer in base
+    Snapshot                                base;    // the last snapshot taken or restored
+
+    void set(size_t i, PagePtr p) {
+        view[i]  = p->data();
+        table[i] = std::move(p);
+    }
+    // A copy of page i, owned until the next snapshot() or restore()
+    uint16_t* make_dirty(size_t i) {
+        auto copy = std::make_shared<Page>(*table[i]);
+        own[i]    = copy->data();
+        written.push_back({i, std::move(table[i])});
+        set(i, std::move(copy));
+        dirty[i / 64] |= 1ull << i % 64;
+        return own[i];
+    }
+    void clear_dirty() {
+        for (auto& [i, before] : written) {
+            dirty[i / 64] &= ~(1ull << i % 64);
+            own[i] = nullptr;
+        }
+        written.clear();
+    }
+
+    static const PagePtr& zero_page() {
+        static const auto zero = std::make_shared<const Page>();
+        return zero;
+    }
+};
@@ -0,0 +1,72 @@
+// Pool
+// MIT License. Copyright 2023 Mirko Palmer (derbroti)
+////////
+
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads running index-parallel jobs
+class Pool {
+public:
+    Pool(size_t threads = std::thread::hardware_concurrency()) {
+        for (size_t i = 0; i < std::max<size_t>(1, threads); ++i)
+            workers.emplace_back([this] { work(); });
+    }
+    ~Pool() {
+        {
+            std::lock_guard lock(m);
+            quit = true;
+        }
+        wake.notify_all();
+        for (auto& w : workers)
+            w.join();
+    }
+    Pool(const Pool&)            = delete;
+    Pool& operator=(const Pool&) = delete;
+
+    size_t size() {
+        return workers.size();
+    }
+
+    // Run f(0) .. f(n - 1) on the workers, returns once all of them returned.
+    void run(size_t n, const std::function<void(size_t)>& f) {
+        std::unique_lock lock(m);
+        job     = &f;
+        next    = 0;
+        total   = n;
+        pending = n;
+        wake.notify_all();
+        done.wait(lock, [this] { return pending == 0; });
+        job = nullptr;
+    }
+
+private:
+    std::vector<std::thread>           workers;
+    std::mutex                         m;
+    std::condition_variable            wake, done;
+    const std::function<void(size_t)>* job  = nullptr;
+    size_t                             next = 0, total = 0, pending = 0;
+    bool                               quit = false;
+
+    void work() {
+        std::unique_lock lock(m);
+        for (;;) {
+            wake.wait(lock, [this] { return quit || (job && next < total); });
+            if (quit)
+                return;
+            size_t i = next++;
+            auto*  f = job;
+            lock.unlock();
+            (*f)(i);
+            lock.lock();
+            if (--pending == 0)
+                done.notify_one();
+        }
+    }
+};
@@ -0,0 +1,71 @@
+// Ring
+// MIT License. Copyright 2023 Mirko Palmer (derbroti)
+////////
+
+// Lock-free single-producer/single-consumer ring buffer.
+//
+// The producer only writes tail, the consumer only writes head; each keeps a cached copy of the
+// other side's index, so the shared cache lines are only touched when the ring looks full (producer)
+// or holds less than asked for (consumer).
+//
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <span>
+#include <type_traits>
+
+template <typename T, size_t N>
+requires (std::has_single_bit(N) && std::is_trivially_copyable_v<T>)
+class Ring {
+public:
+    static constexpr size_t capacity() {
+        return N;
+    }
+
+    // Producer: false if the ring is full
+    bool push(const T& v) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - headCache == N) {
+            headCache = head.load(std::memory_order_acquire);
+            if (t - headCache == N)
+                return false;
+        }
+        buf[t & (N - 1)] = v;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer: take up to out.size() values, returns their number
+    size_t pop(std::span<T> out) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (tailCache - h < out.size()) {
+            tailCache = tail.load(std::memory_order_acquire);
+            if (tailCache == h)
+                return 0;
+        }
+        size_t n = std::min(out.size(), tailCache - h);
+        for (size_t i = 0; i < n; ++i)
+            out[i] = buf[(h + i) & (N - 1)];
+        head.store(h + n, std::memory_order_release);
+        return n;
+    }
+
+    // Either side; exact on the producer side after push(), a snapshot otherwise
+    size_t size() const {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+private:
+    static constexpr size_t LINE = 64;
+
+    alignas(LINE) std::atomic<size_t> head{0}; // next to pop
+    size_t tailCache = 0;                       // consumer's view of tail
+    alignas(LINE) std::atomic<size_t> tail{0}; // next to push
+    size_t headCache = 0;                       // producer's view of head
+    alignas(LINE) std::array<T, N> buf;
+};
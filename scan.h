@@ -0,0 +1,96 @@
+// Scan
+// MIT License. Copyright 2023 Mirko Palmer (derbroti)
+////////
+
+// Parallel decoding of one large memory log, for offline analysis of a whole recorded run.
+//
+// Entries carry no framing, so decoding can only start at known entry boundaries: the log's
+// resync points (its clk index marks, see Coder::resync_points()). The live entries are split at
+// them into ranges, which the workers of a Pool decode independently.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <numeric>
+#include <unordered_map>
+#include <vector>
+#include "coder.h"
+#include "pool.h"
+
+// About parts ranges of similar length, as their boundaries (one more than ranges)
+inline std::vector<Coder::Pos> split(MemCoder& log, size_t parts) {
+    std::vector<Coder::Pos> pts = log.resync_points();
+    if (pts.size() < 2)
+        return pts;
+    size_t ranges = pts.size() - 1;
+    size_t step   = std::max<size_t>(1, ranges / std::max<size_t>(1, parts));
+    std::vector<Coder::Pos> bounds;
+    for (size_t i = 0; i < ranges; i += step)
+        bounds.push_back(pts[i]);
+    bounds.push_back(pts.back());
+    return bounds;
+}
+
+// f(range, const MemEntry&) for every live entry, with absolute clk. Entries of one range arrive
+// in order on one worker; ranges run concurrently.
+template <typename F>
+void scan_parallel(MemCoder& log, Pool& pool, F f, size_t parts = 0) {
+    auto bounds = split(log, parts ? parts : 4 * pool.size());
+    if (bounds.size() < 2)
+        return;
+    pool.run(bounds.size() - 1, [&](size_t i) {
+        uint64_t clk = bounds[i].clk;
+        log.scan(bounds[i], bounds[i + 1], [&](const MemEntry& e) {
+            f(i, MemEntry{clk += e.clk, e.addr, e.val});
+        });
+    });
+}
+
+// All live entries, oldest first, with absolute clk.
+// The workers decode their ranges straight into place (the boundaries' ordinals tell where), with
+// clk summed up relative to the range start. An exclusive prefix sum over the range totals then
+// yields every range's start clk, which a second parallel pass adds in.
+inline std::vector<MemEntry> decode_parallel(MemCoder& log, Pool& pool, size_t parts = 0) {
+    auto bounds = split(log, parts ? parts : 4 * pool.size());
+    if (bounds.size() < 2)
+        return {};
+    size_t                first  = bounds.front().ordinal;
+    size_t                ranges = bounds.size() - 1;
+    std::vector<MemEntry> out(bounds.back().ordinal - first);
+    std::vector<uint64_t> total(ranges + 1);
+
+    pool.run(ranges, [&](size_t i) {
+        MemEntry* e   = out.data() + (bounds[i].ordinal - first);
+        uint64_t  clk = 0;
+        log.scan(bounds[i], bounds[i + 1], [&](const MemEntry& d) {
+            *e++ = {clk += d.clk, d.addr, d.val};
+        });
+        total[i + 1] = clk;
+    });
+
+    total[0] = bounds.front().clk;
+    std::inclusive_scan(total.begin(), total.end(), total.begin());
+    pool.run(ranges, [&](size_t i) {
+        for (size_t n = bounds[i].ordinal - first; n < bounds[i + 1].ordinal - first; ++n)
+            out[n].clk += total[i];
+    });
+    return out;
+}
+
+// Number of writes per address over all live entries
+inline std::unordered_map<uint32_t, uint64_t> write_histogram(MemCoder& log, Pool& pool) {
+    auto bounds = split(log, 4 * pool.size());
+    if (bounds.size() < 2)
+        return {};
+    std::vector<std::unordered_map<uint32_t, uint64_t>> counts(bounds.size() - 1);
+    pool.run(counts.size(), [&](size_t i) {
+        log.scan(bounds[i], bounds[i + 1], [&](const MemEntry& e) { ++counts[i][e.addr]; });
+    });
+    auto& hist = counts.front();
+    for (size_t i = 1; i < counts.size(); ++i) {
+        for (auto& [addr, n] : counts[i])
+            hist[addr] += n;
+    }
+    return std::move(hist);
+}
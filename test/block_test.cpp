@@ -0,0 +1,51 @@
+// Block
+// MIT License. Copyright 2023 Mirko Palmer (derbroti)
+////////
+
+#include "../catch/catch_amalgamated.hpp"
+#include "../block.h"
+#include <random>
+
+TEST_CASE("Block Tests", "") {
+    std::mt19937 rng(42);
+    auto roundtrip = [](const std::vector<uint8_t>& in) {
+        std::vector<uint8_t> packed, out(in.size());
+        Block::pack(in, packed);
+        REQUIRE(Block::unpack(packed, out.data(), out.size()));
+        REQUIRE(out == in);
+        return packed.size();
+    };
+
+    SECTION("Empty and tiny blocks") {
+        for (size_t n = 0; n < 40; ++n)
+            roundtrip(std::vector<uint8_t>(n, 0x81));
+    }
+    SECTION("Incompressible data stays about its size") {
+        std::vector<uint8_t> in(10000);
+        for (auto& b : in)
+            b = rng();
+        REQUIRE(roundtrip(in) <= in.size() + in.size() / 255 + 16);
+    }
+    SECTION("Repetition compresses") {
+        std::vector<uint8_t> in;
+        for (int i = 0; i < 5000; ++i)
+            in.insert(in.end(), {0x81, (uint8_t)(0x80 | (i % 5)), 0x12, 0x34, 0x88});
+        REQUIRE(roundtrip(in) * 20 < in.size());
+    }
+    SECTION("Long literal and match runs, overlapping matches") {
+        std::vector<uint8_t> in;
+        for (int i = 0; i < 300; ++i)
+            in.push_back(rng());
+        in.insert(in.end(), 1000, 7);
+        in.insert(in.end(), in.begin(), in.begin() + 500);
+        roundtrip(in);
+    }
+    SECTION("Malformed input is rejected") {
+        std::vector<uint8_t> in(1000, 3), packed, out(in.size());
+        Block::pack(in, packed);
+        REQUIRE(! Block::unpack(packed, out.data(), out.size() - 1));
+        REQUIRE(! Block::unpack(std::span(packed).first(packed.size() - 2), out.data(), out.size()));
+        packed[1] = packed[2] = 0xFF; // offset past the start
+        REQUIRE(! Block::unpack(packed, out.data(), out.size()));
+    }
+}
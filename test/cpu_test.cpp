@@ -34,3 +34,715 @@ TEST_CASE("CPU Tests", "") {
         }
     }
 }
+
+TEST_CASE("CPU Checkpoint Tests", "") {
+    Cpu_t<8, true> ref(0), cpu(1);
+    cpu.set_checkpoint_interval(16);
+
+    // every odd pc holds a write: (dest << 16) | value
+    for (auto* c : {&ref, &cpu}) {
+        for (uint32_t a = 0; a < 400; a += 2)
+            c->set_inst(a, ((a * 91 + 7) & 0x1FF) << 16 | ((a * 37 + 100) & 0xFFF));
+        c->clk = 1;
+    }
+    std::vector<std::vector<uint16_t>> snaps(1);
+    for (int i = 1; i <= 300; ++i) {
+        snaps.emplace_back(cpu.mem_view.begin(), cpu.mem_view.end());
+        ref.step();
+        cpu.step();
+    }
+    REQUIRE(cpu.num_checkpoints() == 300 / 16);
+    REQUIRE(ref.num_checkpoints() == 0);
+
+    // the log is kept, forward syncs redo it instead of executing (which would drop checkpoints)
+    for (uint64_t t : {290, 250, 240, 251, 112, 111, 113, 17, 16, 15, 1, 300, 150, 32}) {
+        cpu.sync(t);
+        ref.sync(t);
+        REQUIRE(cpu.clk == t);
+        REQUIRE(cpu.pc == t - 1);
+        REQUIRE(std::ranges::equal(cpu.mem_view, snaps[t]));
+        REQUIRE(std::ranges::equal(ref.mem_view, snaps[t]));
+        REQUIRE(cpu.num_checkpoints() == 300 / 16);
+    }
+
+    SECTION("Step back and forth") {
+        for (uint64_t t = 32; t > 20; --t) {
+            cpu.step_back();
+            ref.step_back();
+            REQUIRE(cpu.clk == t - 1);
+            REQUIRE(std::ranges::equal(cpu.mem_view, snaps[t - 1]));
+            REQUIRE(std::ranges::equal(ref.mem_view, snaps[t - 1]));
+        }
+        cpu.sync(64);
+        REQUIRE(std::ranges::equal(cpu.mem_view, snaps[64]));
+        REQUIRE(cpu.num_checkpoints() == 300 / 16);
+    }
+    SECTION("Executing behind the end of the log drops the future") {
+        cpu.step();
+        ref.step();
+        REQUIRE(cpu.num_checkpoints() == 2);
+        REQUIRE(std::ranges::equal(cpu.mem_view, snaps[33]));
+
+        // execution is deterministic, the new future matches the old one
+        cpu.sync(300);
+        ref.sync(300);
+        REQUIRE(cpu.num_checkpoints() == 300 / 16);
+        for (uint64_t t : {299, 100, 200}) {
+            cpu.sync(t);
+            ref.sync(t);
+            REQUIRE(std::ranges::equal(cpu.mem_view, snaps[t]));
+            REQUIRE(std::ranges::equal(ref.mem_view, snaps[t]));
+        }
+    }
+}
+
+TEST_CASE("CPU Register Tests", "") {
+    Cpu_t<8, true> ref(0), cpu(1);
+    cpu.set_checkpoint_interval(0, 64);
+
+    // mix of register immediates, register pair loads and memory writes
+    for (auto* c : {&ref, &cpu}) {
+        for (uint32_t a = 0; a < 400; a += 2) {
+            uint32_t idx = (a * 7) & 0x1F;
+            if (a % 6 == 0)
+                c->set_inst(a, 0x1 << 28 | idx << 16 | ((a * 4099 + 1) & 0xFFFF));
+            else if (a % 6 == 2)
+                c->set_inst(a, 0x2 << 28 | idx << 16 | ((a * 13) & 0x1FF));
+            else
+                c->set_inst(a, ((a * 91 + 7) & 0x1FF) << 16 | ((a * 37 + 100) & 0xFFF));
+        }
+        c->set_register(3, 0xBEEF);
+        c->clk = 1;
+    }
+    // clk 0 is in front of the program and register setup
+    std::vector<std::vector<uint16_t>> mems(1, std::vector<uint16_t>(cpu.mem_view.size()));
+    std::vector<std::vector<uint16_t>> regs(1, std::vector<uint16_t>(cpu.reg_view.size()));
+    for (int i = 1; i <= 300; ++i) {
+        mems.emplace_back(cpu.mem_view.begin(), cpu.mem_view.end());
+        regs.emplace_back(cpu.reg_view.begin(), cpu.reg_view.end());
+        ref.step();
+        cpu.step();
+    }
+    REQUIRE(cpu.num_checkpoints() > 0);
+
+    for (uint64_t t : {299, 170, 171, 5, 1, 0, 300, 100, 7, 260}) {
+        cpu.sync(t);
+        ref.sync(t);
+        REQUIRE(std::ranges::equal(cpu.mem_view, mems[t]));
+        REQUIRE(std::ranges::equal(cpu.reg_view, regs[t]));
+        REQUIRE(std::ranges::equal(ref.mem_view, mems[t]));
+        REQUIRE(std::ranges::equal(ref.reg_view, regs[t]));
+    }
+    cpu.sync(0);
+    REQUIRE(cpu.get_register(3) == 0);
+    cpu.sync(1);
+    REQUIRE(cpu.get_register(3) == 0xBEEF);
+
+    SECTION("Step back over pair loads") {
+        // cycles executing a non-instruction log nothing and are skipped
+        cpu.sync(40);
+        for (uint64_t t = 40; t > 20; t = cpu.clk) {
+            cpu.step_back();
+            REQUIRE(cpu.clk < t);
+            REQUIRE(std::ranges::equal(cpu.reg_view, regs[cpu.clk]));
+            REQUIRE(std::ranges::equal(cpu.mem_view, mems[cpu.clk]));
+        }
+    }
+}
+
+TEST_CASE("CPU Log Budget Tests", "") {
+    Cpu_t<8, true> ref(0), cpu(1);
+    cpu.set_checkpoint_interval(1000);
+    cpu.set_log_budget(2 * Coder::CHUNK_SIZE);
+
+    load_program(ref, regs);
+    load_program(cpu, regs);
+    step_all(100000, ref, cpu);
+    REQUIRE(ref.first_clk() == 0);
+    REQUIRE(cpu.first_clk() > 0);
+    REQUIRE(cpu.num_checkpoints() < 100);
+
+    // going back further than the log reaches stops at first_clk()
+    uint64_t first = cpu.first_clk();
+    for (uint64_t t : {(uint64_t)0, first, first + 1, (uint64_t)99000, first + 5000, (uint64_t)100001}) {
+        cpu.sync(t);
+        ref.sync(std::max(t, first));
+        REQUIRE(cpu.clk == std::max(t, first));
+        REQUIRE(std::ranges::equal(cpu.mem_view, ref.mem_view));
+        REQUIRE(std::ranges::equal(cpu.reg_view, ref.reg_view));
+    }
+
+    // a two step loop, jumping every other step: the jump log is trimmed along
+    for (int i = 0; i < 200000; ++i) {
+        for (auto* c : {&ref, &cpu}) {
+            if (i % 2 == 0)
+                c->pc = 0x40;
+            c->step();
+        }
+    }
+    REQUIRE(ref.jump_log().memory_usage() > 4 * Coder::CHUNK_SIZE);
+    REQUIRE(cpu.jump_log().memory_usage() < 2 * Coder::CHUNK_SIZE);
+    REQUIRE(cpu.jump_log().front_pos().clk < cpu.first_clk());
+    for (uint64_t t : {cpu.first_clk(), cpu.clk - 7, cpu.first_clk() + 101}) {
+        cpu.sync(t);
+        ref.sync(t);
+        REQUIRE(cpu.pc == ref.pc);
+        REQUIRE(std::ranges::equal(cpu.mem_view, ref.mem_view));
+    }
+
+    // a no-op program jumping every fifth step: the jump log runs over the budget on its own
+    Cpu_t<8, true> jumpy(2), plain(3);
+    jumpy.set_log_budget(2 * Coder::CHUNK_SIZE);
+    for (auto* c : {&jumpy, &plain}) {
+        for (uint32_t a = 0x40; a < 0x50; a += 2)
+            c->set_inst(a, 0xF000F000);
+    }
+    for (int i = 0; i < 400000; ++i) {
+        for (auto* c : {&jumpy, &plain}) {
+            if (i % 5 == 0)
+                c->pc = 0x40;
+            c->step();
+        }
+    }
+    REQUIRE(jumpy.jump_log().front_pos().ordinal > 0);
+    first = jumpy.first_clk();
+    for (uint64_t t = first; t < first + 6; ++t) {
+        jumpy.sync(t);
+        plain.sync(t);
+        REQUIRES(jumpy.clk, t, jumpy.pc, plain.pc);
+    }
+}
+
+TEST_CASE("CPU Log Mode Tests", "") {
+    uint8_t mode = GENERATE(MemCoder::addr_delta | MemCoder::same_addr | MemCoder::val_zigzag,
+                            MemCoder::addr_delta | MemCoder::val_xor);
+    Cpu_t<8, true> ref(0), cpu(1);
+    ref.set_checkpoint_interval(500);
+    cpu.set_checkpoint_interval(500);
+    REQUIRE(cpu.set_log_mode(mode));
+
+    load_program(ref, regs);
+    load_program(cpu, regs);
+    REQUIRE(! cpu.set_log_mode(MemCoder::plain));
+    step_all(5000, ref, cpu);
+    for (uint64_t t : {(uint64_t)3, (uint64_t)4990, (uint64_t)2501, (uint64_t)0, (uint64_t)1200, (uint64_t)5001}) {
+        cpu.sync(t);
+        ref.sync(t);
+        REQUIRE(std::ranges::equal(cpu.mem_view, ref.mem_view));
+        REQUIRE(std::ranges::equal(cpu.reg_view, ref.reg_view));
+    }
+    cpu.step_back();
+    ref.step_back();
+    REQUIRE(std::ranges::equal(cpu.mem_view, ref.mem_view));
+}
+
+TEST_CASE("CPU Log Compression Tests", "") {
+    Cpu_t<8, true> ref(0), cpu(1);
+    cpu.set_checkpoint_interval(10000);
+    cpu.set_log_budget(2 * Coder::CHUNK_SIZE, Coder::compress);
+
+    load_program(ref, regs);
+    load_program(cpu, regs);
+    step_all(100000, ref, cpu);
+    REQUIRE(cpu.first_clk() == 0);
+    REQUIRE(cpu.log_block_stats().ratio() > 1);
+
+    for (uint64_t t : {(uint64_t)3, (uint64_t)99000, (uint64_t)50001, (uint64_t)7, (uint64_t)100001}) {
+        cpu.sync(t);
+        ref.sync(t);
+        REQUIRE(std::ranges::equal(cpu.mem_view, ref.mem_view));
+        REQUIRE(std::ranges::equal(cpu.reg_view, ref.reg_view));
+    }
+    REQUIRE(cpu.log_block_stats().thawed > 0);
+}
+
+TEST_CASE("CPU Async Log Tests", "") {
+    Cpu_t<8, true> ref(0), cpu(1);
+    for (auto* c : {&ref, &cpu})
+        c->set_checkpoint_interval(1000, 4096);
+    cpu.set_async_log(true);
+
+    load_program(ref, pairs);
+    load_program(cpu, pairs);
+    step_all(50000, ref, cpu);
+    auto stats = cpu.pipe_stats();
+    REQUIRE(stats.writes > 50000);
+    REQUIRE(stats.peak <= 4096);
+    REQUIRE(cpu.num_checkpoints() > ref.num_checkpoints() / 2); // the byte interval sees the encoder's progress late
+
+    for (uint64_t t : {(uint64_t)3, (uint64_t)49000, (uint64_t)25001, (uint64_t)0, (uint64_t)50001}) {
+        cpu.sync(t);
+        ref.sync(t);
+        REQUIRE(cpu.pipe_stats().occupancy == 0);
+        REQUIRE(std::ranges::equal(cpu.mem_view, ref.mem_view));
+        REQUIRE(std::ranges::equal(cpu.reg_view, ref.reg_view));
+    }
+
+    // a new future after going back
+    cpu.sync(20000);
+    ref.sync(20000);
+    for (auto* c : {&ref, &cpu}) {
+        c->set_inst(40, 0x1234);
+        for (int i = 0; i < 10000; ++i)
+            c->step();
+    }
+    for (uint64_t t : {(uint64_t)19999, (uint64_t)25000, (uint64_t)30000}) {
+        cpu.sync(t);
+        ref.sync(t);
+        REQUIRE(std::ranges::equal(cpu.mem_view, ref.mem_view));
+        REQUIRE(std::ranges::equal(cpu.reg_view, ref.reg_view));
+    }
+    cpu.set_async_log(false);
+    cpu.step_back();
+    ref.step_back();
+    REQUIRE(cpu.clk == ref.clk);
+    REQUIRE(std::ranges::equal(cpu.mem_view, ref.mem_view));
+}
+
+TEST_CASE("CPU Stats Tests", "") {
+    using Cpu = Cpu_t<8, true, true>;
+    // the counters take no room without the flag
+    STATIC_REQUIRE(sizeof(Cpu_t<8, true>) + 300 < sizeof(Cpu));
+
+    Cpu  cpu(0);
+    bool async = GENERATE(false, true);
+    REQUIRE(cpu.set_log_mode(GENERATE(MemCoder::plain, MemCoder::addr_delta | MemCoder::same_addr | MemCoder::val_zigzag)));
+    cpu.set_checkpoint_interval(1000);
+    cpu.set_async_log(async);
+    load_program(cpu, pairs);
+
+    // a monitor polling meanwhile
+    std::atomic<bool> done{false};
+    bool              monotonic = true;
+    std::thread       monitor([&] {
+        uint64_t steps = 0;
+        while (! done.load()) {
+            Cpu::Stats st = cpu.stats();
+            monotonic    &= st.steps >= steps;
+            steps         = st.steps;
+        }
+    });
+    for (int i = 0; i < 20000; ++i)
+        cpu.step();
+    done = true;
+    monitor.join();
+    REQUIRE(monotonic);
+
+    // the field sizes add up to the logs' bytes, the varints too (minus the register index bytes)
+    MemCoder&  log = cpu.mem_log(); // waits for the encoder thread
+    Cpu::Stats st  = cpu.stats();
+    REQUIRE(st.steps == 20000);
+    REQUIRE(st.mem.encoded == log.num_elements());
+    REQUIRE(st.mem.fields[0] + st.mem.fields[1] + st.mem.fields[2] == log.get_size());
+    REQUIRE(st.mem.peakBytes == log.get_size());
+    REQUIRE(st.reg.fields[1] == st.reg.encoded);
+    for (auto* log : {&st.mem, &st.reg}) {
+        uint64_t bytes = 0;
+        for (size_t len = 1; len < 11; ++len)
+            bytes += len * log->varints[len];
+        REQUIRES(bytes + (log == &st.reg ? log->encoded : 0), log->fields[0] + log->fields[1] + log->fields[2]);
+        REQUIRE(log->bytes_per_entry() >= 2);
+    }
+    REQUIRE(st.sync.count == 0);
+
+    cpu.sync(5001);
+    cpu.step_back();
+    cpu.sync(20001);
+    st = cpu.stats();
+    REQUIRES(st.sync.count, 3u, st.stepBack.count, 1u);
+    REQUIRE(st.sync.max > 0);
+    REQUIRE(st.sync.seconds >= st.sync.max);
+    REQUIRE(st.stepBack.seconds > 0);
+    REQUIRE(st.mem.decoded > 0);
+    REQUIRE(st.reg.decoded > 0);
+    REQUIRE(st.steps == 20000); // sync() went through the logs only
+}
+
+TEST_CASE("CPU Sparse Memory Tests", "") {
+    using Cpu = Cpu_t<24, true>;
+    auto cpu  = std::make_unique<Cpu>(0);
+    REQUIRE(cpu->mem_view.size() == 1u << 25);
+    REQUIRE(cpu->mem_view.resident_pages() == 0);
+
+    // a program at the bottom, writing all over the lowest 64K words
+    for (uint32_t a = 0; a < 64; a += 2)
+        cpu->set_inst(a, (a * 7 + 1) << 16 | ((a * 0x1357) & 0xFFFF));
+    cpu->clk = 1;
+    cpu->set_checkpoint_interval(10);
+    for (int i = 0; i < 32; ++i)
+        cpu->step();
+    size_t resident = cpu->mem_view.resident_pages();
+    REQUIRE(resident > 1);
+    REQUIRE(resident < 40);
+    REQUIRE(cpu->num_checkpoints() == 3);
+
+    std::vector<uint16_t> snap(cpu->mem_view.begin(), cpu->mem_view.end());
+    cpu->sync(5);
+    REQUIRE(cpu->mem_view.resident_pages() <= resident);
+    REQUIRE(std::ranges::count_if(cpu->mem_view, [](uint16_t w) { return w != 0; }) < std::ranges::count_if(snap, [](uint16_t w) { return w != 0; }));
+    cpu->sync(33);
+    REQUIRE(std::ranges::equal(cpu->mem_view, snap));
+}
+
+TEST_CASE("Paged Memory Tests", "") {
+    PagedMemory<1 << 16, 256> mem;
+    static_assert(std::ranges::random_access_range<decltype(mem)>);
+    mem.at(0x1234) = 7;
+    mem.at(0x1235) = 8;
+    mem.at(0xFF00) = 9;
+    REQUIRES(mem[0x1234], 7u, mem[0x1235], 8u, mem[0x1236], 0u, mem.resident_pages(), 2u);
+
+    std::vector<size_t> dirty;
+    mem.for_each_dirty([&](size_t p) { dirty.push_back(p); });
+    REQUIRE(dirty == std::vector<size_t>{0x12, 0xFF});
+
+    auto snap = mem.snapshot();
+    mem.for_each_dirty([](size_t) { REQUIRE(false); });
+    REQUIRE(mem.snapshot() == snap); // nothing dirtied in between
+    mem.at(0x1234) = 1; // copy-on-write
+    REQUIRES(mem[0x1234], 1u, mem.is_dirty(0x12), true);
+    mem.restore(snap);
+    REQUIRES(mem[0x1234], 7u, mem.is_dirty(0x12), false);
+
+    // across several deltas, in both directions and onto a branch
+    mem.at(0x1234) = 2;
+    mem.at(0x4000) = 3;
+    auto snap2 = mem.snapshot();
+    mem.at(0x4000) = 4;
+    mem.at(0x0001) = 5;
+    auto snap3 = mem.snapshot();
+    mem.at(0x0001) = 6;
+    mem.restore(snap);
+    REQUIRES(mem[0x1234], 7u, mem[0x4000], 0u, mem[0x0001], 0u);
+    mem.restore(snap3);
+    REQUIRES(mem[0x1234], 2u, mem[0x4000], 4u, mem[0x0001], 5u);
+    mem.restore(snap2);
+    mem.at(0x0002) = 8;
+    auto branch = mem.snapshot();
+    mem.restore(snap3);
+    REQUIRES(mem[0x4000], 4u, mem[0x0001], 5u, mem[0x0002], 0u);
+    mem.restore(branch);
+    REQUIRES(mem[0x1234], 2u, mem[0x4000], 3u, mem[0x0001], 0u, mem[0x0002], 8u);
+
+    mem.release_before(snap2); // snap is not restored anymore
+    mem.restore(snap2);
+    REQUIRES(mem[0x0002], 0u, mem[0x4000], 3u, mem[0x1234], 2u);
+}
+
+TEST_CASE("CPU Diff Tests", "") {
+    Cpu_t<8, true> cpu(0);
+    uint8_t mode = GENERATE(MemCoder::plain, MemCoder::addr_delta | MemCoder::val_xor);
+    REQUIRE(cpu.set_log_mode(mode));
+    cpu.set_checkpoint_interval(100);
+    load_program(cpu, pairs);
+    step_all(3000, cpu);
+
+    auto state = [&](uint64_t t) {
+        cpu.sync(t);
+        return std::pair(std::vector<uint16_t>(cpu.mem_view.begin(), cpu.mem_view.end()),
+                         std::vector<uint16_t>(cpu.reg_view.begin(), cpu.reg_view.end()));
+    };
+    auto apply = [&](std::vector<uint16_t> v, const std::vector<Cpu_t<8, true>::Change>& changes, bool xors) {
+        for (auto& c : changes)
+            v[c.addr] = xors ? v[c.addr] ^ c.delta : v[c.addr] + c.delta;
+        return v;
+    };
+    bool xors = mode & MemCoder::val_xor;
+    for (auto [a, b] : {std::pair<uint64_t, uint64_t>(1, 3001), {500, 501}, {1234, 2345}, {2900, 1500}, {700, 700}}) {
+        auto [memA, regsA] = state(a);
+        auto [memB, regsB] = state(b);
+        cpu.sync(1000);
+        auto d = cpu.diff(a, b);
+        REQUIRE(apply(memA, d.mem, xors) == memB);
+        REQUIRE(apply(regsA, d.regs, false) == regsB);
+        for (auto& c : d.mem)
+            REQUIRE(memA[c.addr] != memB[c.addr]);
+        REQUIRE(std::ranges::is_sorted(d.mem, {}, &Cpu_t<8, true>::Change::addr));
+        REQUIRE(cpu.clk == 1000);
+    }
+}
+
+TEST_CASE("CPU Write Index Tests", "") {
+    Cpu_t<8, true> cpu(0);
+    cpu.set_checkpoint_interval(100);
+    load_program(cpu, writes);
+    step_all(3000, cpu);
+
+    // reference: the clks of all logged writes to addr
+    auto writes_to = [&](uint32_t addr) {
+        std::vector<uint64_t> clks;
+        uint64_t              t = cpu.mem_log().front_pos().clk;
+        for (auto e : cpu.mem_log()) {
+            t += e.clk;
+            if (e.addr == addr)
+                clks.push_back(t);
+        }
+        return clks;
+    };
+    auto check = [&](uint32_t addr) {
+        auto clks = writes_to(addr);
+        REQUIRE(! clks.empty());
+        REQUIRE(! cpu.last_write(addr, clks.front()));
+        for (size_t i = 0; i < clks.size(); ++i) {
+            auto w = cpu.last_write(addr, clks[i] + 1);
+            REQUIRE(w);
+            REQUIRE(w->clk == clks[i]);
+
+            uint64_t clk;
+            uint32_t a;
+            uint16_t val;
+            cpu.mem_log().seek(Coder::l2r, w->offset);
+            cpu.mem_log().decode(clk, a, val);
+            REQUIRE(a == addr);
+        }
+        REQUIRE(cpu.write_history(addr, 0, ~0ull).size() == clks.size());
+    };
+
+    REQUIRE(cpu.watch_writes(0x100, 0x1FF));
+    SECTION("Built lazily from the log") {
+        for (uint32_t addr : {0x100, 0x123, 0x1FF})
+            check(addr);
+        REQUIRE(! cpu.last_write(0x0FF, ~0ull));
+        REQUIRE(cpu.write_history(0x0FF, 0, ~0ull).empty());
+
+        auto h = cpu.write_history(0x123, 1000, 2000);
+        auto c = writes_to(0x123);
+        REQUIRE(h.size() == (size_t)std::ranges::count_if(c, [](uint64_t t) { return 1000 <= t && t < 2000; }));
+    }
+    SECTION("Watching another range, and catching up") {
+        cpu.last_write(0x100, ~0ull);
+        cpu.watch_writes(0x000, 0x0FF);
+        for (int i = 0; i < 1000; ++i)
+            cpu.step();
+        for (uint32_t addr : {0x000, 0x0AB, 0x100, 0x1FF})
+            check(addr);
+    }
+    SECTION("A new future after going back") {
+        check(0x123);
+        cpu.sync(1500);
+        cpu.set_inst(0x122, 0x1234);
+        for (int i = 0; i < 500; ++i)
+            cpu.step();
+        check(0x123);
+        REQUIRE(cpu.last_write(0x123, ~0ull)->clk < 2000);
+    }
+    SECTION("Bounded per address") {
+        cpu.set_watch_limit(3);
+        auto clks = writes_to(0x123);
+        REQUIRE(cpu.write_history(0x123, 0, ~0ull).size() == 3);
+        REQUIRE(cpu.last_write(0x123, ~0ull)->clk == clks.back());
+        REQUIRE(! cpu.last_write(0x123, clks[clks.size() - 3]));
+    }
+    SECTION("Ranges reaching past the memory") {
+        Cpu_t<8, true> other(0);
+        REQUIRE(! other.watch_writes(0x200, 0x2FF));
+        REQUIRE(! other.watch_writes(0x120, 0x110));
+        REQUIRE(other.watch_writes(0x100, 0x200));
+        other.set_checkpoint_interval(100);
+        load_program(other, writes);
+        step_all(3000, other);
+        for (uint32_t addr : {0x100, 0x123, 0x1FF})
+            REQUIRE(std::ranges::equal(other.write_history(addr, 0, ~0ull), cpu.write_history(addr, 0, ~0ull), {}, &WriteIndex::Write::clk, &WriteIndex::Write::clk));
+        REQUIRE(other.write_history(0x000, 0, ~0ull).empty());
+    }
+}
+
+TEST_CASE("CPU Instruction Boundary Tests", "") {
+    Cpu_t<8, true> cpu(0);
+    cpu.set_checkpoint_interval(100);
+    load_program(cpu, writes);
+
+    // pc and memory in front of each clk, with jumps and writes from outside in between
+    std::vector<std::pair<uint32_t, std::vector<uint16_t>>> states(1);
+    for (uint64_t t = 1; t <= 2000; ++t) {
+        if (t % 97 == 0)
+            cpu.pc = (cpu.pc * 7 + 13) & 0x1FF;
+        states.push_back({cpu.pc, std::vector<uint16_t>(cpu.mem_view.begin(), cpu.mem_view.end())});
+        if (t % 150 == 0)
+            cpu.set_inst(t & 0x1FE, (uint32_t)t << 8);
+        cpu.step();
+    }
+    states.push_back({cpu.pc, std::vector<uint16_t>(cpu.mem_view.begin(), cpu.mem_view.end())});
+
+    auto check = [&](uint64_t t) {
+        cpu.sync(t);
+        REQUIRE(cpu.clk == t);
+        REQUIRE(cpu.pc == states[t].first);
+        REQUIRE(std::ranges::equal(cpu.mem_view, states[t].second));
+    };
+    SECTION("Sync back and forth") {
+        for (uint64_t t : {1999, 1940, 1941, 1455, 1500, 1501, 97, 98, 2001, 1, 300, 291, 1164, 1165, 150, 2000})
+            check(t);
+    }
+    SECTION("Step back") {
+        for (int i = 0; i < 50; ++i) {
+            cpu.step_back();
+            REQUIRE(cpu.pc == states[cpu.clk].first);
+            REQUIRE(std::ranges::equal(cpu.mem_view, states[cpu.clk].second));
+        }
+    }
+    SECTION("A new future after a jump in the past") {
+        check(1000);
+        cpu.pc = 0x42;
+        for (int i = 0; i < 100; ++i)
+            cpu.step();
+        REQUIRE(cpu.pc == 0x42 + 100);
+        cpu.sync(1050);
+        REQUIRE(cpu.pc == 0x42 + 50);
+        check(900);
+        cpu.sync(1000);
+        REQUIRE(cpu.pc == 0x42);
+    }
+}
+
+TEST_CASE("CPU Clk Gap Tests", "") {
+    Cpu_t<8, true> cpu(0);
+    load_program(cpu, writes);
+    cpu.step();
+    cpu.step();
+    cpu.clk = 100; // pc continues, clk does not
+    cpu.step();
+    cpu.step();
+    for (auto [t, pc] : {std::pair<uint64_t, uint32_t>(101, 3), {2, 1}, {102, 4}, {100, 2}, {1, 0}, {3, 2}}) {
+        cpu.sync(t);
+        REQUIRES(cpu.clk, t, cpu.pc, pc);
+    }
+
+    SECTION("In front of the first step") {
+        Cpu_t<8, true> late(1);
+        late.set_inst(0, 0x1 << 28 | 1 << 16 | 0x1234); // logged at clk 0
+        late.clk = 50;
+        late.step();
+        late.sync(20);
+        REQUIRES(late.clk, 20u, late.pc, 1u); // nothing ran at 20, pc stays
+        late.sync(51);
+        REQUIRES(late.pc, 1u, late.get_register(1), 0x1234u);
+        late.sync(50);
+        REQUIRES(late.pc, 0u, late.get_register(1), 0u);
+    }
+    SECTION("Writes logged in the cycle of a jump") {
+        Cpu_t<8, true> other(1);
+        load_program(other, writes);
+        other.step();
+        other.step();
+        other.set_register(5, 0x55); // at clk 3, the step below writes at 3 too
+        other.pc = 40;
+        other.step();
+        other.step();
+        other.sync(4);
+        REQUIRES(other.pc, 41u, other.get_register(5), 0x55u);
+        other.sync(3);
+        REQUIRES(other.pc, 40u, other.get_register(5), 0u);
+        other.sync(5);
+        REQUIRES(other.pc, 42u);
+    }
+}
+
+TEST_CASE("CPU Instruction Cache Tests", "") {
+    auto same = [](auto& a, auto& b) {
+        REQUIRES(a.pc, b.pc, a.clk, b.clk);
+        REQUIRE(std::ranges::equal(a.mem_view, b.mem_view));
+        REQUIRE(std::ranges::equal(a.reg_view, b.reg_view));
+    };
+
+    SECTION("Self-modifying program") {
+        // the test program writes all over its own code, also within the running block
+        Cpu_t<8>                     ref(0);
+        Cpu_t<8, false, false, true> cpu(1);
+        load_program(ref, pairs);
+        load_program(cpu, pairs);
+        for (uint64_t n : {1, 5, 31, 32, 33, 100, 1000, 12345}) {
+            step_all(n, ref);
+            cpu.step(n);
+            same(ref, cpu);
+            step_all(n, ref, cpu);
+            same(ref, cpu);
+        }
+        // from outside, into the cached blocks
+        ref.set_inst(ref.pc & 0x1FF, 0x10031111);
+        cpu.set_inst(cpu.pc & 0x1FF, 0x10031111);
+        step_all(1, ref);
+        cpu.step(1);
+        same(ref, cpu);
+        REQUIRE(cpu.get_register(3) == 0x1111);
+    }
+
+    SECTION("Spanning the end of memory") {
+        Cpu_t<8, false, false, true> cpu(0);
+        cpu.set_inst(0x1FF, 0x1 << 28 | 4 << 16 | 0x1); // the low word wraps around to 0
+        cpu.pc = 0x1FF;
+        cpu.step(1);
+        REQUIRE(cpu.get_register(4) == 0x1);
+        cpu.set_inst(0x1FF, 0x1 << 28 | 4 << 16 | 0x2);
+        cpu.pc = 0x1FF;
+        cpu.step(1);
+        REQUIRE(cpu.get_register(4) == 0x2);
+    }
+
+    SECTION("Rewritten by the program, undone by sync") {
+        Cpu_t<8, true, false, true> cpu(0);
+        cpu.set_inst(0, 0x1 << 28 | 3 << 16 | 0x1111); // reg[3] := 0x1111
+        cpu.set_inst(2, 0x0 << 28 | 0x777 << 16 | 1);  // mem[1] := 0x777, the low word of the first one
+        cpu.clk = 1;
+        cpu.step();
+        cpu.pc = 2;
+        cpu.step();
+        cpu.pc = 0;
+        cpu.step();
+        REQUIRE(cpu.get_register(3) == 0x0777);
+
+        cpu.sync(2);
+        cpu.pc = 0;
+        cpu.step();
+        REQUIRE(cpu.get_register(3) == 0x1111);
+    }
+
+    SECTION("Tracked, run in blocks") {
+        Cpu_t<8, true>              ref(0);
+        Cpu_t<8, true, false, true> cpu(1);
+        ref.set_checkpoint_interval(100);
+        cpu.set_checkpoint_interval(100);
+        load_program(ref, pairs);
+        load_program(cpu, pairs);
+        for (uint64_t n : {1, 5, 31, 32, 33, 100, 1000}) {
+            step_all(n, ref);
+            cpu.step(n);
+            same(ref, cpu);
+        }
+        REQUIRE(cpu.num_checkpoints() == ref.num_checkpoints());
+        // a jump, then executing past the logs from within sync()
+        ref.pc = cpu.pc = 0x42;
+        step_all(10, ref);
+        cpu.step(10);
+        for (uint64_t t : {ref.clk + 500, ref.clk - 700, ref.clk + 300}) {
+            ref.sync(t);
+            cpu.sync(t);
+            same(ref, cpu);
+        }
+        ref.sync(700);
+        cpu.sync(700);
+        same(ref, cpu);
+        REQUIRE(cpu.num_checkpoints() == ref.num_checkpoints());
+    }
+
+    SECTION("Undone and redone by sync") {
+        Cpu_t<8, true>              ref(0);
+        Cpu_t<8, true, false, true> cpu(1);
+        ref.set_checkpoint_interval(100);
+        cpu.set_checkpoint_interval(100);
+        load_program(ref, pairs);
+        load_program(cpu, pairs);
+        step_all(2000, ref, cpu);
+        for (uint64_t t : {1500, 1501, 1999, 250, 1, 1200, 1950}) {
+            // run from an older state of the code, decoded again
+            ref.sync(t);
+            cpu.sync(t);
+            same(ref, cpu);
+            step_all(30, ref, cpu);
+            same(ref, cpu);
+            ref.step_back();
+            cpu.step_back();
+            same(ref, cpu);
+        }
+    }
+}
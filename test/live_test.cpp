@@ -0,0 +1,241 @@
+// Live
+// MIT License. Copyright 2023 Mirko Palmer (derbroti)
+////////
+
+#include "../catch/catch_amalgamated.hpp"
+#include "../cpu.h"
+#include "../live.h"
+#include "test.h"
+#include <thread>
+#include <unistd.h>
+
+// The entry with ordinal i of the test streams
+static MemEntry entry(uint64_t i) {
+    return {i % 3, (uint32_t)(i * 7919 % 4096), (uint16_t)(i * 31)};
+}
+TEST_CASE("Live Trace Tests", "") {
+    std::string name = "/coder_live_test_" + std::to_string(::getpid());
+    std::vector<MemEntry> out;
+
+    SECTION("Tail the stream") {
+        for (uint8_t mode : {0, MemCoder::addr_delta | MemCoder::same_addr | MemCoder::val_zigzag}) {
+            MemCoder              mc(256);
+            LiveTrace<MemCoder>   trace(name);
+            LiveReader<MemCoder>  reader(name);
+            REQUIRE(trace.ok());
+            REQUIRE(reader.ok());
+            REQUIRE(mc.set_mode(mode));
+            REQUIRE(reader.read(out) == LiveReader<MemCoder>::empty);
+
+            uint64_t n = 0;
+            for (uint64_t upto : {100u, 101u, 1000u}) {
+                for (; n < upto; ++n)
+                    mc.encode(entry(n).clk, entry(n).addr, entry(n).val);
+                REQUIRE(trace.publish(mc));
+                REQUIRE(trace.back_pos().ordinal == upto);
+
+                REQUIRE(reader.read(out) == (upto == 100 ? LiveReader<MemCoder>::resync : LiveReader<MemCoder>::next));
+                REQUIRES(out.size(), upto - reader.start().ordinal, reader.pos().ordinal, upto, reader.pos().clk, mc.back_pos().clk);
+                for (size_t i = 0; i < out.size(); ++i)
+                    REQUIRE(out[i] == entry(reader.start().ordinal + i));
+                REQUIRE(reader.read(out) == LiveReader<MemCoder>::empty);
+                REQUIRE(out.empty());
+            }
+            REQUIRE(trace.frames() > 3); // a frame per chunk
+            REQUIRE(reader.lost_frames() == 0);
+        }
+    }
+
+    SECTION("Mismatching readers") {
+        LiveTrace<MemCoder> trace(name);
+        REQUIRE(! LiveReader<RegCoder>(name).ok());
+        REQUIRE(! LiveReader<MemCoder>(name + "_missing").ok());
+
+        MemCoder plain, delta;
+        REQUIRE(delta.set_mode(MemCoder::addr_delta));
+        plain.encode(1, 2, 3);
+        delta.encode(1, 2, 3);
+        REQUIRE(trace.publish(plain));
+        REQUIRE(! trace.publish(delta));
+    }
+
+    SECTION("Overrun") {
+        MemCoder             mc(256);
+        LiveTrace<MemCoder>  trace(name, 4096);
+        LiveReader<MemCoder> reader(name);
+        REQUIRE(trace.capacity() == 4096);
+
+        for (uint64_t i = 0; i < 100; ++i)
+            mc.encode(entry(i).clk, entry(i).addr, entry(i).val);
+        REQUIRE(trace.publish(mc));
+        REQUIRE(reader.read(out) == LiveReader<MemCoder>::resync);
+
+        // the writer laps the reader, which continues at the oldest intact frame
+        for (uint64_t i = 100; i < 20000; ++i) {
+            mc.encode(entry(i).clk, entry(i).addr, entry(i).val);
+            if (i % 500 == 0)
+                REQUIRE(trace.publish(mc));
+        }
+        REQUIRE(trace.publish(mc));
+        REQUIRE(reader.read(out) == LiveReader<MemCoder>::overrun);
+        REQUIRE(reader.lost_frames() > 0);
+        REQUIRE(reader.start().ordinal > 100);
+        REQUIRES(reader.pos().ordinal, 20000u, out.size(), 20000 - reader.start().ordinal);
+        for (size_t i = 0; i < out.size(); ++i)
+            REQUIRE(out[i] == entry(reader.start().ordinal + i));
+
+        mc.encode(1, 2, 3);
+        REQUIRE(trace.publish(mc));
+        REQUIRE(reader.read(out) == LiveReader<MemCoder>::next);
+        REQUIRE(out.size() == 1);
+    }
+
+    SECTION("Chunks larger than the ring") {
+        // split into frames at entry boundaries
+        MemCoder             mc;
+        LiveTrace<MemCoder>  trace(name, 4096);
+        LiveReader<MemCoder> reader(name);
+        for (uint64_t i = 0; i < 3000; ++i)
+            mc.encode(entry(i).clk, entry(i).addr, entry(i).val);
+        REQUIRE(mc.get_size() > 2 * trace.capacity());
+        REQUIRE(trace.publish(mc));
+        REQUIRE(trace.frames() > 8);
+        REQUIRE(reader.read(out) == LiveReader<MemCoder>::overrun);
+        REQUIRES(reader.pos().ordinal, 3000u, out.size(), 3000 - reader.start().ordinal);
+        REQUIRE(! out.empty());
+        for (size_t i = 0; i < out.size(); ++i)
+            REQUIRE(out[i] == entry(reader.start().ordinal + i));
+    }
+
+    SECTION("Truncated and evicted") {
+        MemCoder             mc(256);
+        LiveTrace<MemCoder>  trace(name);
+        LiveReader<MemCoder> reader(name);
+        for (uint64_t i = 0; i < 1000; ++i)
+            mc.encode(entry(i).clk, entry(i).addr, entry(i).val);
+        REQUIRE(trace.publish(mc));
+        REQUIRE(reader.read(out) == LiveReader<MemCoder>::resync);
+
+        // grown again past the published end: reported through truncate()
+        Coder::Pos end = mc.truncate(mc.resync_points()[2].offset);
+        REQUIRE(trace.truncate(end));
+        for (uint64_t i = end.ordinal; i < 1000; ++i)
+            mc.encode(7, 1, 1);
+        REQUIRE(trace.publish(mc));
+        REQUIRE(reader.read(out) == LiveReader<MemCoder>::resync);
+        REQUIRES(reader.start().ordinal, end.ordinal, reader.pos().ordinal, 1000u, out.size(), 1000 - end.ordinal);
+        REQUIRE(out.front() == MemEntry{7, 1, 1});
+
+        // shorter than published: noticed by publish() itself
+        end = mc.truncate(mc.resync_points()[1].offset);
+        REQUIRE(trace.publish(mc));
+        REQUIRE(reader.read(out) == LiveReader<MemCoder>::resync);
+        REQUIRES(reader.start().offset, end.offset, out.size(), 0u);
+
+        // dropped before being published: the stream continues at the new front
+        mc.set_memory_budget(512);
+        for (uint64_t i = 0; i < 5000; ++i)
+            mc.encode(entry(i).clk, entry(i).addr, entry(i).val);
+        REQUIRE(mc.begin_offset() > end.offset);
+        REQUIRE(trace.publish(mc));
+        REQUIRE(reader.read(out) == LiveReader<MemCoder>::resync);
+        REQUIRES(reader.start().offset, mc.begin_offset(), reader.pos().ordinal, mc.back_pos().ordinal);
+        REQUIRE(reader.lost_frames() == 0);
+    }
+
+    SECTION("Concurrent reader") {
+        // the writer never waits: the reader sees contiguous runs, separated by overruns
+        MemCoder             mc(256);
+        LiveTrace<MemCoder>  trace(name, 8192);
+        LiveReader<MemCoder> reader(name);
+        std::atomic<bool>    done{false};
+        uint64_t             total = 200000;
+
+        std::thread writer([&] {
+            for (uint64_t i = 0; i < total; ++i) {
+                mc.encode(entry(i).clk, entry(i).addr, entry(i).val);
+                if (i % 64 == 63)
+                    trace.publish(mc);
+            }
+            trace.publish(mc);
+            done = true;
+        });
+        uint64_t next = 0, got = 0;
+        bool     good = true;
+        for (;;) {
+            bool last = done;
+            auto s    = reader.read(out);
+            if (s == LiveReader<MemCoder>::empty) {
+                if (last)
+                    break;
+                continue;
+            }
+            good = good && (s == LiveReader<MemCoder>::next ? reader.start().ordinal == next : reader.start().ordinal >= next);
+            for (size_t i = 0; i < out.size(); ++i)
+                good = good && out[i] == entry(reader.start().ordinal + i);
+            next = reader.pos().ordinal;
+            got += out.size();
+        }
+        writer.join();
+        REQUIRE(good);
+        REQUIRE(next == total);
+        REQUIRE(got > 0);
+    }
+}
+
+TEST_CASE("CPU Live Export Tests", "") {
+    std::string name  = "/coder_live_cpu_test_" + std::to_string(::getpid());
+    bool        async = GENERATE(false, true);
+
+    Cpu_t<8, true>       cpu(0);
+    LiveTrace<MemCoder>  mem(name + "_mem");
+    LiveTrace<RegCoder>  reg(name + "_reg");
+    LiveReader<MemCoder> memReader(name + "_mem");
+    LiveReader<RegCoder> regReader(name + "_reg");
+    load_program(cpu, regs);
+    cpu.set_checkpoint_interval(100);
+    cpu.set_live_export(&mem, &reg, 50);
+    cpu.set_async_log(async);
+
+    // what the readers saw, by ordinal
+    std::vector<MemEntry> mems, memOut;
+    std::vector<RegEntry> regs, regOut;
+    auto follow = [&] {
+        for (LiveReader<MemCoder>::status_t s; (s = memReader.read(memOut)) != LiveReader<MemCoder>::empty;) {
+            REQUIRE(s != LiveReader<MemCoder>::overrun);
+            mems.resize(memReader.start().ordinal);
+            mems.insert(mems.end(), memOut.begin(), memOut.end());
+        }
+        for (LiveReader<RegCoder>::status_t s; (s = regReader.read(regOut)) != LiveReader<RegCoder>::empty;) {
+            REQUIRE(s != LiveReader<RegCoder>::overrun);
+            regs.resize(regReader.start().ordinal);
+            regs.insert(regs.end(), regOut.begin(), regOut.end());
+        }
+    };
+
+    for (int i = 0; i < 1000; ++i) {
+        cpu.step();
+        if (i % 100 == 0)
+            follow();
+    }
+    // published by the encoder thread, which is done once the log is flushed
+    cpu.flush_log();
+    follow();
+    REQUIRE(mems.size() + 100 > cpu.mem_log().num_elements());
+    // a new future, published over the rewound one
+    cpu.sync(400);
+    for (int i = 0; i < 300; ++i)
+        cpu.step();
+    cpu.set_inst(2, 0x1234);
+    REQUIRE(cpu.publish_live());
+    follow();
+
+    MemCoder& log = cpu.mem_log();
+    REQUIRE(mems.size() == log.num_elements());
+    size_t i = 0;
+    for (MemEntry e : log)
+        REQUIRE(mems[i++] == e);
+    REQUIRE(memReader.pos().offset == log.end_offset());
+    REQUIRE(regReader.pos().ordinal == regs.size());
+    REQUIRE(regs.size() > 0);
+}
@@ -5,6 +5,8 @@
 #include "../catch/catch_amalgamated.hpp"
 #include "../coder.h"
 #include "test.h"
+#include <ranges>
+#include <thread>
 
 TEST_CASE("MemCoder Tests", "") {
     uint64_t clk;
@@ -85,3 +87,593 @@ TEST_CASE("MemCoder Tests", "") {
     }
 }
 
+TEST_CASE("MemCoder Chunk Tests", "") {
+    uint64_t clk;
+    uint32_t addr;
+    uint16_t val;
+    MemCoder mc(32);
+    MemCoder ref;
+
+    for (uint64_t i = 0; i < 100; ++i) {
+        mc.encode(i * i * 1021, (uint32_t)(i * 7919), (uint16_t)(i * 31));
+        ref.encode(i * i * 1021, (uint32_t)(i * 7919), (uint16_t)(i * 31));
+    }
+    REQUIRE(mc.get_size() == ref.get_size());
+    REQUIRE(mc.num_elements() == 100);
+
+    SECTION("Same bytes as a single chunk") {
+        REQUIRE(mc.dump() == ref.dump());
+        ref.reset_iter();
+        for (uint64_t i = 0; i < 100; ++i) {
+            ref.decode(clk, addr, val);
+            REQUIRES(clk, i * i * 1021, addr, (uint32_t)(i * 7919), val, (uint16_t)(i * 31));
+        }
+    }
+    SECTION("Non-Destr. Decoding l2r and r2l") {
+        mc.reset_iter();
+        for (uint64_t i = 0; i < 100; ++i) {
+            mc.decode(clk, addr, val);
+            REQUIRES(clk, i * i * 1021, addr, (uint32_t)(i * 7919), val, (uint16_t)(i * 31));
+        }
+        for (uint64_t i = 100; i-- > 0;) {
+            mc.decode<Coder::non_destr, Coder::r2l>(clk, addr, val);
+            REQUIRES(clk, i * i * 1021, addr, (uint32_t)(i * 7919), val, (uint16_t)(i * 31));
+        }
+        REQUIRE(mc.get_size() == ref.get_size());
+    }
+    SECTION("Seek and truncate") {
+        mc.reset_iter();
+        for (uint64_t i = 0; i < 40; ++i)
+            mc.decode(clk, addr, val);
+        size_t offs = mc.tell(Coder::l2r);
+
+        mc.seek(Coder::r2l, offs);
+        mc.decode<Coder::non_destr, Coder::r2l>(clk, addr, val);
+        REQUIRES(clk, 39u * 39u * 1021u, addr, 39u * 7919u, val, 39u * 31u);
+
+        mc.seek(Coder::l2r, offs);
+        mc.decode(clk, addr, val);
+        REQUIRES(clk, 40u * 40u * 1021u, addr, 40u * 7919u, val, 40u * 31u);
+
+        REQUIRE(mc.truncate(offs).ordinal == 40);
+        REQUIRE(mc.num_elements() == 40);
+        REQUIRE(mc.end_offset() == offs);
+        REQUIRE(mc.get_size() == offs);
+
+        mc.reset_iter();
+        mc.decode<Coder::non_destr, Coder::r2l>(clk, addr, val);
+        REQUIRES(clk, 39u * 39u * 1021u, addr, 39u * 7919u, val, 39u * 31u);
+    }
+    SECTION("Destr. Decoding from both ends") {
+        mc.reset_iter();
+        for (uint64_t i = 0; i < 50; ++i) {
+            mc.decode<Coder::destr, Coder::l2r>(clk, addr, val);
+            REQUIRES(clk, i * i * 1021, addr, (uint32_t)(i * 7919), val, (uint16_t)(i * 31));
+
+            uint64_t j = 99 - i;
+            mc.decode<Coder::destr, Coder::r2l>(clk, addr, val);
+            REQUIRES(clk, j * j * 1021, addr, (uint32_t)(j * 7919), val, (uint16_t)(j * 31));
+        }
+        REQUIRE(mc.num_elements() == 0);
+        REQUIRE(mc.get_size() == 0);
+
+        SECTION("Encode after drain") {
+            mc.encode(0x1000, 0xFFAA33, 0xf100);
+            REQUIRE(mc.print({0x0,0xa0,0x33,0x54,0x7e,0x87,0x0,0x62,0x83}, true));
+
+            mc.reset_iter();
+            mc.decode<Coder::destr, Coder::r2l>(clk, addr, val);
+            REQUIRES(clk, 0x1000u, addr, 0xFFAA33u, val, 0xf100u);
+        }
+    }
+}
+
+TEST_CASE("MemCoder Kernel Tests", "") {
+    uint64_t clk;
+    uint32_t addr;
+    uint16_t val;
+
+    std::vector<uint64_t> clks;
+    for (int bits = 0; bits <= 64; ++bits) {
+        uint64_t v = bits == 64 ? ~0ull : (1ull << bits);
+        clks.insert(clks.end(), {v - 1, v, v + 1});
+    }
+    auto addr_of = [](size_t i) { return (uint32_t)(0x9E3779B9u * i) >> (i % 32); };
+    auto val_of  = [](size_t i) { return (uint16_t)(0xFFFF >> (i % 16)); };
+
+    auto kernel = Coder::get_kernel();
+    Coder::set_kernel(Coder::scalar);
+    MemCoder ref;
+    for (size_t i = 0; i < clks.size(); ++i)
+        ref.encode(clks[i], addr_of(i), val_of(i));
+
+    for (auto k : {Coder::scalar, Coder::swar, Coder::bmi2}) {
+        Coder::set_kernel(k);
+        MemCoder mc(64);
+        for (size_t i = 0; i < clks.size(); ++i)
+            mc.encode(clks[i], addr_of(i), val_of(i));
+        REQUIRE(mc.dump() == ref.dump());
+
+        mc.reset_iter();
+        for (size_t i = 0; i < clks.size(); ++i) {
+            mc.decode(clk, addr, val);
+            REQUIRES(clk, clks[i], addr, addr_of(i), val, val_of(i));
+        }
+        for (size_t i = clks.size(); i-- > 0;) {
+            mc.decode<Coder::non_destr, Coder::r2l>(clk, addr, val);
+            REQUIRES(clk, clks[i], addr, addr_of(i), val, val_of(i));
+        }
+        mc.reset_iter();
+        for (size_t i = 0, j = clks.size() - 1; i < j; ++i, --j) {
+            mc.decode<Coder::destr, Coder::l2r>(clk, addr, val);
+            REQUIRES(clk, clks[i], addr, addr_of(i), val, val_of(i));
+            mc.decode<Coder::destr, Coder::r2l>(clk, addr, val);
+            REQUIRES(clk, clks[j], addr, addr_of(j), val, val_of(j));
+        }
+        size_t m = clks.size() / 2;
+        mc.decode<Coder::destr, Coder::r2l>(clk, addr, val);
+        REQUIRES(clk, clks[m], addr, addr_of(m), val, val_of(m));
+        REQUIRE(mc.get_size() == 0);
+    }
+    Coder::set_kernel(kernel);
+}
+
+TEST_CASE("MemCoder Batch Tests", "") {
+    std::vector<MemEntry> in;
+    for (uint64_t i = 0; i < 500; ++i)
+        in.push_back({i % 7 ? i : i << 40, (uint32_t)(i * 40503) & 0xFFFFFF, (uint16_t)(i * 257)});
+
+    MemCoder ref;
+    for (auto& e : in)
+        ref.encode(e.clk, e.addr, e.val);
+
+    MemCoder mc(64);
+    mc.encode_batch(std::span(in).first(123));
+    mc.encode_batch(std::span(in).subspan(123));
+    REQUIRE(mc.dump() == ref.dump());
+    REQUIRE(mc.num_elements() == in.size());
+
+    std::vector<MemEntry> out(in.size() + 10);
+
+    SECTION("Non-Destr. Decoding l2r") {
+        mc.reset_iter();
+        size_t n = 0;
+        while (size_t got = mc.decode_batch(std::span(out).subspan(n, std::min<size_t>(37, out.size() - n))))
+            n += got;
+        REQUIRE(n == in.size());
+        REQUIRE(std::equal(in.begin(), in.end(), out.begin()));
+        REQUIRE(mc.num_elements() == in.size());
+    }
+    SECTION("Destr. Decoding r2l") {
+        mc.reset_iter();
+        REQUIRE(mc.decode_batch<Coder::destr, Coder::r2l>(std::span(out).first(100)) == 100);
+        REQUIRE(std::equal(in.rbegin(), in.rbegin() + 100, out.begin()));
+        REQUIRE(mc.num_elements() == in.size() - 100);
+
+        REQUIRE(mc.decode_batch<Coder::destr, Coder::r2l>(out) == in.size() - 100);
+        REQUIRE(std::equal(in.rbegin() + 100, in.rend(), out.begin()));
+        REQUIRE(mc.num_elements() == 0);
+        REQUIRE(mc.get_size() == 0);
+    }
+    SECTION("Mixed with single entry decoding") {
+        uint64_t clk;
+        uint32_t addr;
+        uint16_t val;
+
+        mc.reset_iter();
+        mc.decode<Coder::destr>(clk, addr, val);
+        REQUIRE(mc.decode_batch<Coder::destr>(std::span(out).first(10)) == 10);
+        REQUIRE(std::equal(in.begin() + 1, in.begin() + 11, out.begin()));
+
+        mc.decode<Coder::destr, Coder::r2l>(clk, addr, val);
+        REQUIRES(clk, in.back().clk, addr, in.back().addr, val, in.back().val);
+        REQUIRE(mc.num_elements() == in.size() - 12);
+    }
+}
+
+TEST_CASE("MemCoder Index Tests", "") {
+    uint64_t clk;
+    uint32_t addr;
+    uint16_t val;
+
+    // clk deltas with runs of zeros, absolute clks are their prefix sums
+    std::vector<uint64_t> abs;
+    MemCoder mc(64);
+    mc.set_index_interval(4);
+    for (uint32_t i = 0, sum = 0; i < 300; ++i) {
+        uint64_t delta = i % 5 ? 0 : i % 13 + 1;
+        sum += delta;
+        abs.push_back(sum);
+        mc.encode(delta, i, (uint16_t)i);
+    }
+    // index of the first entry with an absolute clk >= t
+    auto first = [&](uint64_t t) { return (size_t)(std::ranges::lower_bound(abs, t) - abs.begin()); };
+
+    auto check = [&](size_t lo, size_t hi) {
+        for (uint64_t t = 0; t <= abs.back() + 1; ++t) {
+            size_t i = std::clamp(first(t), lo, hi);
+            auto pos = mc.seek(t);
+            REQUIRE(pos.ordinal == i);
+            REQUIRE(pos.clk == (i ? abs[i - 1] : 0));
+            if (i < hi) {
+                mc.decode(clk, addr, val);
+                REQUIRE(addr == i);
+            }
+            if (i > lo) {
+                mc.decode<Coder::non_destr, Coder::r2l>(clk, addr, val);
+                REQUIRE(addr == i - 1);
+            }
+        }
+    };
+
+    SECTION("Seek") {
+        check(0, 300);
+        REQUIRE(mc.back_pos().ordinal == 300);
+        REQUIRE(mc.back_pos().clk == abs.back());
+    }
+    SECTION("Seek after destr. decoding from both ends") {
+        mc.reset_iter();
+        for (int i = 0; i < 37; ++i)
+            mc.decode<Coder::destr, Coder::l2r>(clk, addr, val);
+        for (int i = 0; i < 41; ++i)
+            mc.decode<Coder::destr, Coder::r2l>(clk, addr, val);
+        REQUIRE(mc.front_pos().ordinal == 37);
+        REQUIRE(mc.front_pos().clk == abs[36]);
+        REQUIRE(mc.back_pos().ordinal == 259);
+        REQUIRE(mc.back_pos().clk == abs[258]);
+        check(37, 259);
+
+        std::vector<MemEntry> out(20);
+        mc.reset_iter();
+        mc.decode_batch<Coder::destr, Coder::l2r>(out);
+        mc.decode_batch<Coder::destr, Coder::r2l>(out);
+        REQUIRE(mc.front_pos().clk == abs[56]);
+        REQUIRE(mc.back_pos().clk == abs[238]);
+        check(57, 239);
+    }
+    SECTION("Truncate") {
+        mc.seek(150);
+        size_t i = first(150);
+        auto pos = mc.truncate(mc.tell(Coder::l2r));
+        REQUIRE(pos.ordinal == i);
+        REQUIRE(mc.num_elements() == i);
+        REQUIRE(mc.back_pos().clk == abs[i - 1]);
+        check(0, i);
+
+        mc.encode(5, 1000, 0);
+        mc.reset_iter();
+        mc.decode<Coder::non_destr, Coder::r2l>(clk, addr, val);
+        REQUIRE(mc.seek(abs[i - 1] + 5).ordinal == i);
+    }
+    SECTION("Dropping the chunks in front of an entry") {
+        auto pos = mc.find(150);
+        mc.drop_before(pos.offset);
+        auto front = mc.front_pos();
+        REQUIRE(front.ordinal > 0);
+        REQUIRE(front.ordinal <= pos.ordinal);
+        REQUIRE(mc.num_elements() == 300 - front.ordinal);
+        check(front.ordinal, 300);
+
+        mc.drop_before(front.offset);
+        REQUIRE(mc.front_pos().ordinal == front.ordinal);
+        mc.drop_before(mc.back_pos().offset);
+        REQUIRE(mc.segments().size() == 1);
+    }
+}
+
+TEST_CASE("MemCoder Budget Tests", "") {
+    uint64_t clk;
+    uint32_t addr;
+    uint16_t val;
+    MemCoder mc(256);
+
+    SECTION("Segments") {
+        for (uint32_t i = 0; i < 1000; ++i)
+            mc.encode(1, i, 0);
+        auto segs = mc.segments();
+        REQUIRE(segs.size() > 1);
+        REQUIRE(segs.front().from.ordinal == 0);
+        REQUIRE(segs.back().to.ordinal == 1000);
+        for (size_t i = 1; i < segs.size(); ++i) {
+            REQUIRE(segs[i].from.offset == segs[i - 1].to.offset);
+            REQUIRE(segs[i].from.ordinal == segs[i - 1].to.ordinal);
+            REQUIRE(segs[i].from.clk == segs[i].from.ordinal);
+        }
+
+        // each segment decodes on its own
+        auto& seg = segs[2];
+        mc.seek(Coder::l2r, seg.from.offset);
+        for (size_t i = seg.from.ordinal; i < seg.to.ordinal; ++i) {
+            mc.decode(clk, addr, val);
+            REQUIRE(addr == i);
+        }
+        REQUIRE(mc.tell(Coder::l2r) == seg.to.offset);
+    }
+    SECTION("Dropping the oldest chunks") {
+        size_t budget = 4 * (256 + 2 * Coder::PADDING);
+        mc.set_memory_budget(budget);
+        for (uint32_t i = 0; i < 10000; ++i) {
+            mc.encode(1, i, (uint16_t)i);
+            REQUIRE(mc.memory_usage() <= budget);
+        }
+        REQUIRE(mc.segments().size() == 4);
+
+        auto front = mc.front_pos();
+        REQUIRE(front.ordinal > 0);
+        REQUIRE(front.clk == front.ordinal);
+        REQUIRE(mc.num_elements() == 10000 - front.ordinal);
+        REQUIRE(mc.seek(0).ordinal == front.ordinal);
+
+        mc.reset_iter();
+        for (uint32_t i = front.ordinal; i < 10000; ++i) {
+            mc.decode<Coder::destr, Coder::l2r>(clk, addr, val);
+            REQUIRES(clk, 1u, addr, i, val, (uint16_t)i);
+        }
+        REQUIRE(mc.num_elements() == 0);
+    }
+}
+
+TEST_CASE("MemCoder Compression Tests", "") {
+    uint64_t clk;
+    uint32_t addr;
+    uint16_t val;
+    MemCoder mc(1024);
+    mc.set_memory_budget(4 * (1024 + 2 * Coder::PADDING), Coder::compress);
+
+    // a loop writing the same few addresses with repeating values
+    auto entry = [](uint32_t i) { return std::tuple<uint64_t, uint32_t, uint16_t>(i % 4 ? 0 : 3, 0x1000 + i % 8, (uint16_t)(i % 8 * 16)); };
+    for (uint32_t i = 0; i < 20000; ++i) {
+        auto [c, a, v] = entry(i);
+        mc.encode(c, a, v);
+    }
+    auto stats = mc.block_stats();
+    REQUIRE(stats.blocks > 0);
+    REQUIRE(stats.ratio() > 4);
+    REQUIRE(mc.memory_usage() * 4 < mc.get_size());
+    REQUIRE(mc.num_elements() == 20000);
+    REQUIRE(mc.segments()[1].compressed);
+    REQUIRE(mc.front_pos().ordinal == 0);
+
+    SECTION("Decompressed on demand r2l") {
+        mc.reset_iter(Coder::r2l);
+        for (uint32_t i = 20000; i-- > 0;) {
+            mc.decode<Coder::non_destr, Coder::r2l>(clk, addr, val);
+            auto [c, a, v] = entry(i);
+            REQUIRES(clk, c, addr, a, val, v);
+        }
+        REQUIRE(mc.block_stats().thawed > 0);
+        REQUIRE(mc.block_stats().throughput() > 0);
+    }
+    SECTION("Seek into a compressed chunk") {
+        REQUIRE(mc.seek(3 * 1000 + 1).ordinal == 4000);
+        mc.decode(clk, addr, val);
+        REQUIRE(addr == 0x1000);
+        REQUIRE(std::ranges::count(mc.segments(), false, &Coder::Segment::compressed) <= 4);
+    }
+    SECTION("Destr. decoding from both ends") {
+        mc.seek(Coder::r2l, mc.end_offset());
+        for (uint32_t i = 20000; i-- > 15000;)
+            mc.decode<Coder::destr, Coder::r2l>(clk, addr, val);
+        mc.reset_iter(Coder::l2r);
+        for (uint32_t i = 0; i < 15000; ++i) {
+            mc.decode<Coder::destr, Coder::l2r>(clk, addr, val);
+            auto [c, a, v] = entry(i);
+            REQUIRES(clk, c, addr, a, val, v);
+        }
+        REQUIRE(mc.num_elements() == 0);
+        REQUIRE(mc.get_size() == 0);
+    }
+}
+
+// Write deltas of a small program: filling an array, pushing/popping a stack, counting down
+static std::vector<MemEntry> program_writes() {
+    std::vector<MemEntry> in;
+    for (uint32_t i = 0; i < 3000; ++i) {
+        switch (i / 100 % 3) {
+            case 0: in.push_back({1, 0x4000 + i, (uint16_t)(i * 3)}); break;
+            case 1: in.push_back({i % 2, 0xFFF0 - i % 8, (uint16_t)(i % 2 ? -(int)(i % 5) : i % 5)}); break;
+            case 2: in.push_back({3, 0x8000, (uint16_t)-1}); break;
+        }
+    }
+    return in;
+}
+static const std::vector<uint8_t> MODES{MemCoder::plain, MemCoder::val_zigzag, MemCoder::addr_delta,
+                                        MemCoder::addr_delta | MemCoder::same_addr,
+                                        MemCoder::addr_delta | MemCoder::same_addr | MemCoder::val_zigzag};
+
+// Entries with addrs known to fit 17 bit, as a Cpu_t<16, true> writes them
+TEST_CASE("MemCoder Bounded Width Tests", "") {
+    uint64_t clk;
+    uint32_t addr;
+    uint16_t val;
+
+    std::vector<uint64_t> clks;
+    for (int bits = 0; bits < 64; ++bits) {
+        uint64_t v = 1ull << bits;
+        clks.insert(clks.end(), {v - 1, v, v + 1});
+    }
+    clks.insert(clks.end(), {~0ull - 1, ~0ull, ~0ull, 0}); // same_addr flags a 65 bit clk field
+    // the last ones repeat their addr
+    auto addr_of = [n = clks.size() - 4](size_t i) { return i < n ? (0x9E3779B9u * (uint32_t)i >> (i % 32)) & 0x1FFFF : 0x42; };
+    auto val_of  = [](size_t i) { return (uint16_t)(0xFFFF >> (i % 16) ^ -(i & 1)); };
+
+    uint8_t mode   = GENERATE(from_range(MODES));
+    auto    kernel = Coder::get_kernel();
+    for (auto k : {Coder::scalar, Coder::swar, Coder::bmi2}) {
+        Coder::set_kernel(k);
+        MemCoder ref(64), mc(64);
+        ref.set_mode(mode);
+        mc.set_mode(mode);
+        for (size_t i = 0; i < clks.size(); ++i) {
+            auto   fields = ref.layout(clks[i], addr_of(i), val_of(i));
+            size_t size   = ref.get_size();
+            ref.encode(clks[i], addr_of(i), val_of(i));
+            mc.encode<17>(clks[i], addr_of(i), val_of(i));
+            REQUIRE(size + fields[0] + fields[1] + fields[2] == ref.get_size());
+        }
+        REQUIRE(mc.dump() == ref.dump());
+
+        mc.reset_iter();
+        for (size_t i = 0; i < clks.size(); ++i) {
+            mc.decode<Coder::non_destr, Coder::l2r, 17>(clk, addr, val);
+            REQUIRES(clk, clks[i], addr, addr_of(i), val, val_of(i));
+        }
+        for (size_t i = clks.size(); i-- > 0;) {
+            mc.decode<Coder::non_destr, Coder::r2l, 17>(clk, addr, val);
+            REQUIRES(clk, clks[i], addr, addr_of(i), val, val_of(i));
+        }
+    }
+    Coder::set_kernel(kernel);
+}
+
+TEST_CASE("MemCoder Mode Sizes", "") {
+    auto in = program_writes();
+
+    std::vector<double> bytes;
+    for (uint8_t m : MODES) {
+        MemCoder mc;
+        mc.set_mode(m);
+        mc.encode_batch(in);
+        bytes.push_back((double)mc.get_size() / in.size());
+        UNSCOPED_INFO("mode " << (int)m << ": " << bytes.back() << " bytes/entry"); // shown on failure
+    }
+    REQUIRE(std::ranges::is_sorted(bytes, std::greater<>()));
+    REQUIRE(bytes.back() * 1.8 < bytes.front());
+}
+
+TEST_CASE("MemCoder Mode Tests", "") {
+    uint64_t clk;
+    uint32_t addr;
+    uint16_t val;
+
+    auto in   = program_writes();
+
+    uint8_t  mode = GENERATE(from_range(MODES));
+    MemCoder mc(256);
+    mc.set_index_interval(16);
+    REQUIRE(mc.set_mode(mode));
+    for (auto& e : std::span(in).first(1000))
+        mc.encode(e.clk, e.addr, e.val);
+    mc.encode_batch(std::span(in).subspan(1000));
+    REQUIRE(! mc.set_mode(MemCoder::plain));
+    REQUIRE(mc.get_mode() == mode);
+
+    std::vector<MemEntry> out(in.size());
+    SECTION("Decoding l2r and r2l") {
+        mc.reset_iter();
+        REQUIRE(mc.decode_batch(out) == in.size());
+        REQUIRE(std::equal(in.begin(), in.end(), out.begin()));
+
+        for (size_t i = in.size(); i-- > 0;) {
+            mc.decode<Coder::non_destr, Coder::r2l>(clk, addr, val);
+            REQUIRES(clk, in[i].clk, addr, in[i].addr, val, in[i].val);
+        }
+    }
+    SECTION("Seeking picks up the address context") {
+        for (size_t i : {(size_t)1, (size_t)150, (size_t)1234, (size_t)2999}) {
+            uint64_t t = 0;
+            for (auto& e : std::span(in).first(i))
+                t += e.clk;
+            auto pos = mc.seek(t + 1);
+            mc.decode(clk, addr, val);
+            REQUIRE(addr == in[pos.ordinal].addr);
+            mc.decode<Coder::non_destr, Coder::r2l>(clk, addr, val);
+            REQUIRE(addr == in[pos.ordinal - 1].addr);
+
+            mc.seek(Coder::r2l, pos.offset);
+            mc.decode<Coder::non_destr, Coder::r2l>(clk, addr, val);
+            REQUIRE(addr == in[pos.ordinal - 1].addr);
+        }
+    }
+    SECTION("Destr. decoding from both ends, truncating and appending") {
+        auto pos = mc.truncate(mc.seek(4000).offset);
+        REQUIRE(mc.num_elements() == pos.ordinal);
+        mc.reset_iter();
+        REQUIRE(mc.decode_batch<Coder::destr, Coder::r2l>(std::span(out).first(10)) == 10);
+        REQUIRE(std::equal(out.begin(), out.begin() + 10, in.rend() - pos.ordinal));
+        for (size_t i = 0; i < 500; ++i) {
+            mc.decode<Coder::destr>(clk, addr, val);
+            REQUIRES(clk, in[i].clk, addr, in[i].addr, val, in[i].val);
+        }
+        for (size_t i = pos.ordinal - 10; i < in.size(); ++i)
+            mc.encode(in[i].clk, in[i].addr, in[i].val);
+
+        mc.reset_iter();
+        REQUIRE(mc.decode_batch(out) == in.size() - 500);
+        REQUIRE(std::equal(in.begin() + 500, in.end(), out.begin()));
+    }
+}
+
+TEST_CASE("MemCoder Iterator Tests", "") {
+    static_assert(std::bidirectional_iterator<MemCoder::iterator>);
+    static_assert(std::ranges::bidirectional_range<MemCoder>);
+    static_assert(std::ranges::bidirectional_range<const MemCoder>);
+
+    auto in   = program_writes();
+
+    uint8_t  mode = GENERATE(from_range(MODES));
+    MemCoder mc(256);
+    mc.set_index_interval(16);
+    mc.set_mode(mode);
+    mc.set_memory_budget(8 * (256 + 2 * Coder::PADDING), Coder::compress);
+    mc.encode_batch(in);
+    REQUIRE(mc.block_stats().blocks > 0);
+    size_t thawed = mc.block_stats().thawed;
+
+    SECTION("Forwards and backwards") {
+        REQUIRE(std::ranges::equal(mc, in));
+        REQUIRE(std::ranges::equal(mc | std::views::reverse, in | std::views::reverse));
+        REQUIRE(std::ranges::distance(mc) == (std::ptrdiff_t)in.size());
+        const MemCoder& view = mc;
+        REQUIRE(std::ranges::equal(view | std::views::reverse, in | std::views::reverse));
+
+        auto it = mc.end();
+        std::ranges::advance(it, -1500, mc.begin());
+        REQUIRE(it.pos().ordinal == 1500);
+        REQUIRE(*it == in[1500]);
+        ++it;
+        --it;
+        --it;
+        REQUIRE(*it == in[1499]);
+        REQUIRE(mc.block_stats().thawed == thawed);
+    }
+    SECTION("Starting at a resync point") {
+        for (auto& pos : mc.resync_points()) {
+            MemCoder::iterator it(&mc, pos);
+            if (it == mc.end())
+                break;
+            REQUIRE(*it == in[pos.ordinal]);
+            REQUIRE(it.pos().clk == pos.clk);
+        }
+    }
+    SECTION("Concurrent readers, the coder's own cursors untouched") {
+        uint64_t clk;
+        uint32_t addr;
+        uint16_t val;
+        mc.reset_iter();
+        mc.decode(clk, addr, val);
+
+        std::vector<size_t> counts(4);
+        std::vector<std::thread> readers;
+        for (size_t t = 0; t < counts.size(); ++t) {
+            readers.emplace_back([&mc, &counts, t] {
+                counts[t] = std::ranges::count_if(mc, [&](const MemEntry& e) { return e.addr == 0x8000; });
+            });
+        }
+        for (auto& r : readers)
+            r.join();
+        auto want = std::ranges::count(in, 0x8000u, &MemEntry::addr);
+        REQUIRE(std::ranges::count(counts, want) == 4);
+
+        mc.decode(clk, addr, val);
+        REQUIRES(clk, in[1].clk, addr, in[1].addr, val, in[1].val);
+    }
+    SECTION("After destructive decodes") {
+        std::vector<MemEntry> out(100);
+        mc.reset_iter();
+        mc.decode_batch<Coder::destr>(out);
+        mc.decode_batch<Coder::destr, Coder::r2l>(out);
+        REQUIRE(std::ranges::equal(mc, std::span(in).subspan(100, in.size() - 200)));
+        REQUIRE(mc.begin().pos().ordinal == 100);
+    }
+}
@@ -0,0 +1,21 @@
+// Coder
+// MIT License. Copyright 2023 Mirko Palmer (derbroti)
+////////
+
+#pragma once
+
+#include <cstdint>
+
+// The CPU test program: a loop over 256 instructions writing memory, with every third one a
+// register write instead (regs), and some of the others a register pair load on top (pairs).
+// clk starts at 1. The benchmarks run it too.
+enum program_t { writes, regs, pairs };
+
+template <typename Cpu>
+void load_program(Cpu& c, program_t kind) {
+    for (uint32_t a = 0; a < 512; a += 2) {
+        uint32_t op = kind != writes && a % 6 == 0 ? 0x1 : kind == pairs && a % 10 == 2 ? 0x2 : 0x0;
+        c.set_inst(a, op << 28 | ((a * 91 + 7) & 0x1FF) << 16 | ((a * 37 + 100) & (kind == regs ? 0xFFF : 0x1FF)));
+    }
+    c.clk = 1;
+}
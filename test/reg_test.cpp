@@ -5,6 +5,7 @@
 #include "../catch/catch_amalgamated.hpp"
 #include "../coder.h"
 #include "test.h"
+#include <ranges>
 
 TEST_CASE("RecCoder Tests", "") {
     uint64_t clk;
@@ -145,3 +146,86 @@ TEST_CASE("RecCoder Tests", "") {
     }
 }
 
+TEST_CASE("RegCoder Batch Tests", "") {
+    std::vector<RegEntry> in = {
+        {0xf343, 0x11, 0, 0x4456, 0, false},
+        {0x12, 0x11, 0x10, 0xef01, 0xabcd, true},
+        {0x123456789abcd, 0x1, 0x11, 0x0, 0x1111, true},
+        {0x0, 21, 0, 0xd00d, 0, false},
+        {0x1, 17, 0, 0xdd, 0, false},
+        {0x2,  1, 0, 0x1, 0, false},
+    };
+    RegCoder rc(32);
+    rc.encode_batch(in);
+
+    REQUIRE(rc.print({0x91,0x2b,0xc4,0x43,0x66,0x83,
+                      0xf1,0x0,0x6f,0x1b,0x2f,0x85,0x92,
+                      0xa1,0x0,0x0,0x22,0xc4,0x4d,0x57,0x26,0x3c,0x56,0x68,0xc8,
+                      0xd5,0x6,0x50,0x81,0x80,
+                      0xd1,0xee,0x81,
+                      0xc1,0x80,0x82}, true));
+    REQUIRE(rc.num_elements() == 6);
+
+    std::vector<RegEntry> out(8);
+    SECTION("Non-Destr. Decoding l2r") {
+        rc.reset_iter();
+        REQUIRE(rc.decode_batch(out) == 6);
+        REQUIRE(std::equal(in.begin(), in.end(), out.begin()));
+    }
+    SECTION("Destr. Decoding r2l") {
+        rc.reset_iter();
+        REQUIRE(rc.decode_batch<Coder::destr, Coder::r2l>(out) == 6);
+        REQUIRE(std::equal(in.rbegin(), in.rend(), out.begin()));
+        REQUIRE(rc.num_elements() == 0);
+        REQUIRE(rc.get_size() == 0);
+    }
+}
+
+TEST_CASE("RegCoder Index Tests", "") {
+    uint64_t clk;
+    uint16_t val1, val2;
+    uint8_t  idx1, idx2;
+    RegCoder rc(32);
+    rc.set_index_interval(3);
+
+    for (uint16_t i = 0; i < 100; ++i) {
+        if (i % 3)
+            rc.encode(2, i % 16, i);
+        else
+            rc.encode(2, i % 16, i, i);
+    }
+    auto pos = rc.seek(101);
+    REQUIRE(pos.ordinal == 50);
+    REQUIRE(pos.clk == 100);
+    rc.decode(clk, idx2, val2, idx1, val1);
+    REQUIRE(val1 == 50);
+
+    rc.reset_iter();
+    rc.decode<Coder::destr, Coder::r2l>(clk, idx2, val2, idx1, val1);
+    rc.decode<Coder::destr, Coder::l2r>(clk, idx2, val2, idx1, val1);
+    REQUIRE(rc.seek(0).ordinal == 1);
+    REQUIRE(rc.seek(1000).ordinal == 99);
+    REQUIRE(rc.back_pos().clk == 198);
+}
+
+TEST_CASE("RegCoder Iterator Tests", "") {
+    static_assert(std::ranges::bidirectional_range<RegCoder>);
+    static_assert(std::ranges::bidirectional_range<const RegCoder>);
+
+    RegCoder rc(32);
+    std::vector<RegEntry> in;
+    for (uint16_t i = 0; i < 100; ++i) {
+        bool two = i % 3 == 0;
+        uint8_t idx1 = two ? i % 16 : i % 32;
+        in.push_back({i % 4u, idx1, two ? RegCoder::decode_idx2(idx1) : (uint8_t)0, (uint16_t)(i * 7), (uint16_t)(two ? i : 0), two});
+        if (two)
+            rc.encode(in.back().clk, in.back().idx1, in.back().high_value, in.back().low_value);
+        else
+            rc.encode(in.back().clk, in.back().idx1, in.back().low_value);
+    }
+    REQUIRE(std::ranges::equal(rc, in));
+    REQUIRE(std::ranges::equal(rc | std::views::reverse, in | std::views::reverse));
+    REQUIRE(std::ranges::next(rc.begin(), 50).pos().clk == rc.seek(75).clk);
+    const RegCoder& view = rc;
+    REQUIRE(std::ranges::equal(view, in));
+}
@@ -0,0 +1,49 @@
+// Ring
+// MIT License. Copyright 2023 Mirko Palmer (derbroti)
+////////
+
+#include "../catch/catch_amalgamated.hpp"
+#include "../ring.h"
+#include <thread>
+#include <vector>
+
+TEST_CASE("Ring Tests", "") {
+    std::vector<uint64_t> out(8);
+
+    SECTION("Full and empty") {
+        Ring<uint64_t, 4> ring;
+        REQUIRE(ring.pop(out) == 0);
+        for (uint64_t i = 0; i < 4; ++i)
+            REQUIRE(ring.push(i));
+        REQUIRE(! ring.push(4));
+        REQUIRE(ring.size() == 4);
+
+        REQUIRE(ring.pop(std::span(out).first(3)) == 3);
+        REQUIRE(ring.push(4));
+        REQUIRE(ring.push(5));
+        REQUIRE(ring.pop(out) == 3);
+        REQUIRE(std::vector<uint64_t>(out.begin(), out.begin() + 3) == std::vector<uint64_t>{3, 4, 5});
+        REQUIRE(ring.size() == 0);
+    }
+    SECTION("Producer and consumer thread") {
+        constexpr uint64_t N = 1000000;
+        Ring<uint64_t, 64> ring;
+
+        std::thread producer([&] {
+            for (uint64_t i = 0; i < N;) {
+                if (ring.push(i))
+                    ++i;
+            }
+        });
+        uint64_t next = 0;
+        bool     ordered = true;
+        while (next < N) {
+            size_t n = ring.pop(out);
+            for (size_t i = 0; i < n; ++i)
+                ordered = ordered && out[i] == next++;
+        }
+        producer.join();
+        REQUIRE(ordered);
+        REQUIRE(ring.size() == 0);
+    }
+}
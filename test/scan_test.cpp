@@ -0,0 +1,83 @@
+// Scan
+// MIT License. Copyright 2023 Mirko Palmer (derbroti)
+////////
+
+#include "../catch/catch_amalgamated.hpp"
+#include "../scan.h"
+#include "test.h"
+#include <map>
+#include <ranges>
+
+TEST_CASE("Parallel Scan Tests", "") {
+    uint64_t clk;
+    uint32_t addr;
+    uint16_t val;
+
+    uint8_t  mode = GENERATE(MemCoder::plain, MemCoder::addr_delta | MemCoder::same_addr | MemCoder::val_zigzag);
+    MemCoder mc(1024);
+    mc.set_index_interval(32);
+    mc.set_mode(mode);
+    mc.set_memory_budget(8 * (1024 + 2 * Coder::PADDING), Coder::compress);
+
+    std::vector<MemEntry> in;
+    for (uint32_t i = 0; i < 50000; ++i)
+        in.push_back({i % 3, 0x2000 + (i * 7 + i / 100) % 300, (uint16_t)(i * 13)});
+    mc.encode_batch(in);
+    REQUIRE(mc.block_stats().blocks > 0);
+
+    // consume some from the front, so the live entries start mid-stream
+    mc.reset_iter();
+    for (int i = 0; i < 1234; ++i)
+        mc.decode<Coder::destr>(clk, addr, val);
+
+    // sequential reference, absolute clk
+    std::vector<MemEntry> want;
+    std::map<uint32_t, uint64_t> hist;
+    clk = mc.front_pos().clk;
+    for (size_t i = 1234; i < in.size(); ++i) {
+        want.push_back({clk += in[i].clk, in[i].addr, in[i].val});
+        ++hist[in[i].addr];
+    }
+    Pool pool(4);
+
+    SECTION("Resync points") {
+        auto pts = mc.resync_points();
+        REQUIRE(pts.size() > 1000);
+        REQUIRE(pts.front().ordinal == 1234);
+        REQUIRE(pts.back().ordinal == in.size());
+        for (size_t i = 1; i < pts.size(); ++i) {
+            MemEntry first{};
+            Coder::Pos to = mc.scan(pts[i - 1], pts[i], [&](const MemEntry& e) {
+                if (! first.val && ! first.addr)
+                    first = e;
+            });
+            REQUIRES(to.offset, pts[i].offset, to.ordinal, pts[i].ordinal, to.clk, pts[i].clk, to.addr, pts[i].addr);
+            REQUIRE(first.addr == in[pts[i - 1].ordinal].addr);
+        }
+    }
+    SECTION("Decode") {
+        size_t thawed = mc.block_stats().thawed;
+        for (size_t parts : {1, 3, 16, 10000}) {
+            auto got = decode_parallel(mc, pool, parts);
+            REQUIRE(std::ranges::equal(got, want));
+        }
+        REQUIRE(mc.block_stats().thawed == thawed);
+    }
+    SECTION("Scan") {
+        std::vector<std::vector<MemEntry>> ranges(64);
+        scan_parallel(mc, pool, [&](size_t i, const MemEntry& e) { ranges[i].push_back(e); }, 8);
+        REQUIRE(std::ranges::count_if(ranges, [](auto& r) { return ! r.empty(); }) >= 8);
+        REQUIRE(std::ranges::equal(ranges | std::views::join, want));
+    }
+    SECTION("Write histogram") {
+        auto got = write_histogram(mc, pool);
+        REQUIRE(got.size() == hist.size());
+        for (auto& [a, n] : hist)
+            REQUIRE(got[a] == n);
+    }
+    SECTION("Empty") {
+        MemCoder empty;
+        REQUIRE(decode_parallel(empty, pool).empty());
+        REQUIRE(write_histogram(empty, pool).empty());
+    }
+}
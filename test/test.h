@@ -2,6 +2,10 @@
 // MIT License. Copyright 2023 Mirko Palmer (derbroti)
 ////////
 
+#pragma once
+
+#include "program.h"
+
 template <typename = void, typename = void>
 void REQUIRES() {}
 
@@ -11,3 +15,9 @@ void REQUIRES(T got, U want, Args... args) {
     REQUIRES(args...);
 }
 
+// Step all cpus n times, in lockstep
+template <typename... Cpu>
+void step_all(uint64_t n, Cpu&... cpus) {
+    for (uint64_t i = 0; i < n; ++i)
+        (cpus.step(), ...);
+}
@@ -0,0 +1,110 @@
+// Timeline
+// MIT License. Copyright 2023 Mirko Palmer (derbroti)
+////////
+
+#include "../catch/catch_amalgamated.hpp"
+#include "../cpu.h"
+#include "../timeline.h"
+#include "test.h"
+#include <deque>
+
+TEST_CASE("Timeline Tests", "") {
+    using Cpu = Cpu_t<8, true>;
+    std::deque<Cpu> cores, refs;
+    std::vector<Cpu*> cpus;
+    for (uint8_t id = 0; id < 4; ++id) {
+        for (auto* q : {&cores, &refs}) {
+            Cpu& c = q->emplace_back(id);
+            c.set_checkpoint_interval(500);
+            for (uint32_t a = 0; a < 512; a += 2)
+                c.set_inst(a, (a % (6 + id) == 0 ? 0x1 << 28 : 0) | ((a * (91 + id) + 7) & 0x1FF) << 16 | ((a * 37 + id) & 0xFFF));
+            c.clk = 1;
+        }
+        cpus.push_back(&cores.back());
+        cores.back().set_async_log(id % 2);
+    }
+    for (int i = 0; i < 3000; ++i) {
+        for (auto& c : cores)
+            c.step();
+        for (auto& c : refs)
+            c.step();
+    }
+
+    // all writes, ordered by (clk, cpu); writes of one core within a cycle keep their order
+    std::vector<Timeline::Entry> all;
+    for (Cpu* c : cpus) {
+        MemCoder& log = c->mem_log();
+        uint64_t  clk = 0, delta;
+        uint32_t  addr;
+        uint16_t  val;
+        log.reset_iter();
+        while (log.tell(Coder::l2r) != log.end_offset()) {
+            log.decode(delta, addr, val);
+            all.push_back({clk += delta, c->id, addr, val});
+        }
+    }
+    std::ranges::stable_sort(all, [](auto& a, auto& b) { return std::tie(a.clk, a.cpu) < std::tie(b.clk, b.cpu); });
+
+    Timeline tl = timeline(std::span<Cpu* const>(cpus));
+    Timeline::Entry e;
+
+    SECTION("Forwards and backwards") {
+        for (auto& want : all) {
+            REQUIRE(tl.next(e));
+            REQUIRE(e == want);
+        }
+        REQUIRE(! tl.next(e));
+        for (size_t i = all.size(); i-- > 0;) {
+            REQUIRE(tl.next<Coder::r2l>(e));
+            REQUIRE(e == all[i]);
+        }
+        REQUIRE(! tl.next<Coder::r2l>(e));
+    }
+    SECTION("Seek") {
+        for (uint64_t t : {(uint64_t)1, (uint64_t)1500, (uint64_t)2999, (uint64_t)5000}) {
+            tl.seek(t);
+            size_t i = std::ranges::lower_bound(all, t, {}, &Timeline::Entry::clk) - all.begin();
+            for (size_t j = i; j < std::min(i + 50, all.size()); ++j) {
+                REQUIRE(tl.next(e));
+                REQUIRE(e == all[j]);
+            }
+            for (size_t j = i; j-- > (i > 50 ? i - 50 : 0);) {
+                REQUIRE(tl.next<Coder::r2l>(e));
+                REQUIRE(e == all[j]);
+            }
+        }
+    }
+    SECTION("Cores syncing meanwhile") {
+        // the timeline reads through its own iterators, not the logs' cursors
+        size_t i = 0;
+        for (; i < all.size() / 2; ++i) {
+            REQUIRE(tl.next(e));
+            REQUIRE(e == all[i]);
+        }
+        cores[0].sync(250);
+        cores[1].sync(400);
+        cores[0].sync(2900);
+        for (; i < all.size(); ++i) {
+            REQUIRE(tl.next(e));
+            REQUIRE(e == all[i]);
+        }
+        REQUIRE(! tl.next(e));
+        cores[2].sync(10);
+        for (size_t j = all.size(); j-- > 0;) {
+            REQUIRE(tl.next<Coder::r2l>(e));
+            REQUIRE(e == all[j]);
+        }
+    }
+    SECTION("Sync all cores in parallel") {
+        Pool pool(3);
+        for (uint64_t t : {(uint64_t)10, (uint64_t)2500, (uint64_t)1234, (uint64_t)3001}) {
+            sync_all(std::span<Cpu* const>(cpus), t, pool);
+            for (size_t i = 0; i < cpus.size(); ++i) {
+                refs[i].sync(t);
+                REQUIRE(cpus[i]->clk == t);
+                REQUIRE(std::ranges::equal(cpus[i]->mem_view, refs[i].mem_view));
+                REQUIRE(std::ranges::equal(cpus[i]->reg_view, refs[i].reg_view));
+            }
+        }
+    }
+}
@@ -0,0 +1,209 @@
+// Trace
+// MIT License. Copyright 2023 Mirko Palmer (derbroti)
+////////
+
+#include "../catch/catch_amalgamated.hpp"
+#include "../trace.h"
+#include "test.h"
+#include <filesystem>
+#include <fstream>
+
+// Mappings of path in this process (Linux), 0 where /proc is missing
+static size_t mappings(const std::string& path) {
+    std::ifstream maps("/proc/self/maps");
+    size_t        n = 0;
+    for (std::string line; std::getline(maps, line);)
+        n += line.ends_with(path);
+    return n;
+}
+
+TEST_CASE("Trace Tests", "") {
+    uint64_t clk;
+    uint32_t addr;
+    uint16_t val;
+
+    auto path = (std::filesystem::temp_directory_path() / "coder_trace_test.trc").string();
+    std::filesystem::remove(path);
+
+    // recorded in one process...
+    {
+        MemCoder mc(256);
+        Trace    trace(path, Trace::mem);
+        REQUIRE(trace.ok());
+        for (uint64_t i = 0; i < 1000; ++i) {
+            mc.encode(i % 3, (uint32_t)(i * 7919), (uint16_t)(i * 31));
+            if (i % 300 == 299)
+                REQUIRE(trace.append(mc));
+        }
+        REQUIRE(trace.append(mc));
+        REQUIRE(trace.num_segments() == 4);
+        REQUIRE(trace.back_pos().ordinal == 1000);
+    }
+
+    // ...and replayed in a later one
+    MemCoder mc;
+    Trace    trace(path, Trace::mem);
+    REQUIRE(trace.ok());
+    REQUIRE(trace.num_segments() == 4);
+    REQUIRE(trace.attach(mc));
+    REQUIRE(mc.num_elements() == 1000);
+    REQUIRE(mc.back_pos().clk == 999);
+
+    SECTION("Decoding from both ends") {
+        for (uint64_t i = 0; i < 1000; ++i) {
+            mc.decode(clk, addr, val);
+            REQUIRES(clk, i % 3, addr, (uint32_t)(i * 7919), val, (uint16_t)(i * 31));
+        }
+        for (uint64_t i = 1000; i-- > 0;) {
+            mc.decode<Coder::non_destr, Coder::r2l>(clk, addr, val);
+            REQUIRES(clk, i % 3, addr, (uint32_t)(i * 7919), val, (uint16_t)(i * 31));
+        }
+    }
+    SECTION("Seek") {
+        // clks are sums of 0,1,2,0,1,2...: entry 3k+2 reaches 3k+3
+        auto pos = mc.seek(600);
+        REQUIRE(pos.ordinal == 599);
+        mc.decode(clk, addr, val);
+        REQUIRE(addr == (uint32_t)(599 * 7919));
+    }
+    SECTION("Destr. decoding and appending") {
+        for (int i = 0; i < 10; ++i)
+            mc.decode<Coder::destr, Coder::r2l>(clk, addr, val);
+        mc.encode(5, 1, 2);
+        REQUIRE(mc.num_elements() == 991);
+        REQUIRE(! trace.append(mc)); // the trace does not end where mc's live bytes start
+
+        MemCoder cont;
+        REQUIRE(trace.attach(cont));
+        for (uint32_t i = 0; i < 50; ++i)
+            cont.encode(1, i, 0);
+        REQUIRE(trace.append(cont));
+
+        MemCoder again;
+        Trace    reopened(path, Trace::mem);
+        REQUIRE(reopened.attach(again));
+        REQUIRE(again.num_elements() == 1050);
+        again.reset_iter();
+        again.decode<Coder::non_destr, Coder::r2l>(clk, addr, val);
+        REQUIRES(clk, 1u, addr, 49u);
+    }
+    SECTION("Rejects other kinds and versions") {
+        REQUIRE(! Trace(path, Trace::reg).ok());
+        RegCoder rc;
+        REQUIRE(! trace.attach(rc));
+
+        {
+            std::FILE* f = std::fopen(path.c_str(), "r+b");
+            uint32_t version = Trace::VERSION + 1;
+            std::fseek(f, 8, SEEK_SET);
+            std::fwrite(&version, sizeof(version), 1, f);
+            std::fclose(f);
+        }
+        REQUIRE(! Trace(path, Trace::mem).ok());
+    }
+    SECTION("Ignores a torn last segment") {
+        std::filesystem::resize_file(path, std::filesystem::file_size(path) - 10);
+        Trace torn(path, Trace::mem);
+        REQUIRE(torn.ok());
+        REQUIRE(torn.num_segments() == 3);
+
+        MemCoder part;
+        REQUIRE(torn.attach(part));
+        REQUIRE(part.num_elements() == 900);
+    }
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Trace Spill Tests", "") {
+    uint64_t clk;
+    uint32_t addr;
+    uint16_t val;
+
+    auto path = (std::filesystem::temp_directory_path() / "coder_spill_test.trc").string();
+    std::filesystem::remove(path);
+
+    // the default window, windows of a few pages, and windows too large to map
+    size_t window = GENERATE(as<size_t>{}, Trace::WINDOW, 16384, (size_t)1 << 62);
+    bool   mapped = window < (size_t)1 << 62;
+    {
+        MemCoder mc(256);
+        Trace    trace(path, Trace::mem);
+        size_t   budget = 3 * (256 + 2 * Coder::PADDING);
+        REQUIRE(trace.spill_from(mc, budget, window));
+
+        for (uint32_t i = 0; i < 5000; ++i) {
+            mc.encode(i % 2, i, (uint16_t)(i * 3));
+            if (mapped)
+                REQUIRE(mc.memory_usage() <= budget);
+        }
+        REQUIRE(mc.num_elements() == 5000);
+        // a failed spill is reported, the chunk stays in memory
+        REQUIRE(mc.within_budget() == mapped);
+        REQUIRE((trace.num_segments() == 0) == ! mapped);
+        if (mapped) {
+            REQUIRE(trace.num_segments() > 10);
+            REQUIRE(mappings(path) <= (window == Trace::WINDOW ? 1 : trace.num_segments() / 10));
+        }
+
+        // spilled entries still decode from both ends, seek still finds them
+        REQUIRE(mc.seek(1001).ordinal == 2001);
+        mc.decode(clk, addr, val);
+        REQUIRES(clk, 1u, addr, 2001u);
+        mc.reset_iter();
+        for (uint32_t i = 5000; i-- > 0;) {
+            mc.decode<Coder::destr, Coder::r2l>(clk, addr, val);
+            REQUIRES(clk, i % 2u, addr, i, val, (uint16_t)(i * 3));
+        }
+        REQUIRE(mc.num_elements() == 0);
+    }
+    // the spilled prefix is a regular trace
+    MemCoder mc;
+    Trace    trace(path, Trace::mem);
+    REQUIRE(trace.attach(mc));
+    REQUIRE(mc.num_elements() == trace.back_pos().ordinal);
+    for (uint32_t i = 0; i < mc.num_elements(); ++i) {
+        mc.decode(clk, addr, val);
+        REQUIRES(clk, i % 2u, addr, i);
+    }
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Trace Mode Tests", "") {
+    uint64_t clk;
+    uint32_t addr;
+    uint16_t val;
+
+    auto path = (std::filesystem::temp_directory_path() / "coder_trace_mode_test.trc").string();
+    std::filesystem::remove(path);
+
+    uint8_t mode = MemCoder::addr_delta | MemCoder::same_addr | MemCoder::val_zigzag;
+    {
+        MemCoder mc(256);
+        Trace    trace(path, Trace::mem);
+        mc.set_mode(mode);
+        for (uint32_t i = 0; i < 1000; ++i)
+            mc.encode(1, 0x100 + i / 3, (uint16_t)-(int)i);
+        REQUIRE(trace.append(mc));
+
+        MemCoder plain;
+        plain.encode(1, 2, 3);
+        REQUIRE(! trace.append(plain));
+    }
+
+    // the mode comes from the file header
+    MemCoder mc;
+    Trace    trace(path, Trace::mem);
+    REQUIRE(trace.attach(mc));
+    REQUIRE(mc.get_mode() == mode);
+    REQUIRE(mc.seek(501).ordinal == 500);
+    for (uint32_t i = 500; i < 1000; ++i) {
+        mc.decode(clk, addr, val);
+        REQUIRES(clk, 1u, addr, 0x100 + i / 3, val, (uint16_t)-(int)i);
+    }
+    mc.reset_iter(Coder::r2l);
+    for (uint32_t i = 1000; i-- > 0;) {
+        mc.decode<Coder::non_destr, Coder::r2l>(clk, addr, val);
+        REQUIRES(clk, 1u, addr, 0x100 + i / 3, val, (uint16_t)-(int)i);
+    }
+    std::filesystem::remove(path);
+}
@@ -0,0 +1,135 @@
+// Timeline
+// MIT License. Copyright 2023 Mirko Palmer (derbroti)
+////////
+
+// One global timeline over several cores, each recording into its own memory delta log.
+//
+// Timeline merges the logs n-way into (clk, cpu id) order, forwards and backwards.
+// sync_all() rewinds or replays all cores to the same clk, in parallel on a Pool.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <span>
+#include <tuple>
+#include <vector>
+#include "coder.h"
+#include "pool.h"
+
+class Timeline {
+public:
+    struct Entry {
+        uint64_t clk; // absolute
+        uint8_t  cpu;
+        uint32_t addr;
+        uint16_t val;
+
+        bool operator==(const Entry&) const = default;
+    };
+
+    // Logs are read through iterators of their own (see Coder::Iterator), the logs' cursors stay
+    // untouched: the cores may sync() meanwhile. They must not be written to while being read.
+    void add(uint8_t cpu, MemCoder& log) {
+        streams.push_back({cpu, &log, {}});
+        reset(Coder::l2r);
+        reset(Coder::r2l);
+    }
+
+    // l2r: continue from the oldest entry, r2l: from the newest one
+    void reset(Coder::dir_t dir) {
+        heads[dir].clear();
+        for (auto& s : streams)
+            s.it[dir] = dir == Coder::l2r ? s.log->begin() : s.log->end();
+        fill(dir);
+    }
+
+    // l2r continues with the first entry at clk or later, r2l with the last one in front of it.
+    void seek(uint64_t clk) {
+        heads[Coder::l2r].clear();
+        heads[Coder::r2l].clear();
+        for (auto& s : streams)
+            s.it[Coder::l2r] = s.it[Coder::r2l] = MemCoder::iterator(s.log, s.log->find(clk));
+        fill(Coder::l2r);
+        fill(Coder::r2l);
+    }
+
+    // The next entry in direction V; false at the end.
+    template <Coder::dir_t V = Coder::l2r>
+    bool next(Entry& e) {
+        auto& heap = heads[V];
+        if (heap.empty())
+            return false;
+        std::ranges::pop_heap(heap, later<V>);
+        e = heap.back().e;
+        size_t i = heap.back().stream;
+        heap.pop_back();
+        fetch<V>(i);
+        return true;
+    }
+
+private:
+    struct Stream {
+        uint8_t            cpu;
+        MemCoder*          log;
+        MemCoder::iterator it[2]; // per direction: l2r at the next entry, r2l behind it
+    };
+    struct Head {
+        Entry  e;
+        size_t stream;
+    };
+    std::vector<Stream> streams;
+    std::vector<Head>   heads[2]; // per direction: the next entry of each stream, as a heap
+
+    // Heap order: the entry to come first in direction V is the top
+    template <Coder::dir_t V>
+    static bool later(const Head& a, const Head& b) {
+        if constexpr (V == Coder::l2r)
+            return std::tie(a.e.clk, a.e.cpu) > std::tie(b.e.clk, b.e.cpu);
+        else
+            return std::tie(a.e.clk, a.e.cpu) < std::tie(b.e.clk, b.e.cpu);
+    }
+
+    void fill(Coder::dir_t dir) {
+        for (size_t i = 0; i < streams.size(); ++i) {
+            if (dir == Coder::l2r)
+                fetch<Coder::l2r>(i);
+            else
+                fetch<Coder::r2l>(i);
+        }
+    }
+
+    template <Coder::dir_t V>
+    void fetch(size_t i) {
+        Stream&             s  = streams[i];
+        MemCoder::iterator& it = s.it[V];
+        if constexpr (V == Coder::l2r) {
+            if (it.pos().offset == s.log->end_offset())
+                return;
+        } else {
+            if (it.pos().offset == s.log->begin_offset())
+                return;
+            --it;
+        }
+        MemEntry m = *it;
+        heads[V].push_back({{it.pos().clk + m.clk, s.cpu, m.addr, m.val}, i});
+        if constexpr (V == Coder::l2r)
+            ++it;
+        std::ranges::push_heap(heads[V], later<V>);
+    }
+};
+
+// Rewind or replay every core to targetClk, one core per worker at a time.
+template <typename Cpu>
+void sync_all(std::span<Cpu* const> cpus, uint64_t targetClk, Pool& pool) {
+    pool.run(cpus.size(), [&](size_t i) { cpus[i]->sync(targetClk); });
+}
+
+// The merged timeline of the cores' memory logs
+template <typename Cpu>
+Timeline timeline(std::span<Cpu* const> cpus) {
+    Timeline t;
+    for (Cpu* c : cpus)
+        t.add(c->id, c->mem_log());
+    return t;
+}
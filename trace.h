@@ -0,0 +1,314 @@
+// Trace
+// MIT License. Copyright 2023 Mirko Palmer (derbroti)
+////////
+
+// Append-only trace file for MemCoder / RegCoder streams (POSIX).
+// Reopened traces are decoded straight from a read-only mapping of the file.
+//
+// File layout (host byte order):
+// ------------------------------
+//
+// |------ 8 byte ------|-- 4 byte --|----- 4 byte ----|-- 4 byte --|-- 4 byte --|---- n segments ----|
+// magic "CODERTRC",     version,     kind (mem/reg),   field mode,  zero,        segment...
+//
+// The field mode is the coder's (see MemCoder::set_mode()), taken from the first appended coder.
+//
+// Segment:
+// --------
+//
+// |--- 32 byte ---|--- 32 byte ---|- 8 byte -|-- to.offset - from.offset --|-- PADDING+ --|-- marks * 32 byte --|
+// Pos from,        Pos to,         marks,     encoded entries,              zero bytes,    clk index marks (Pos)
+//
+// The zero bytes (PADDING, rounded up to keep segments 8 byte aligned) let the word-at-a-time
+// kernels overshoot the entries of the mapped file.
+//
+// Every append() writes one segment, holding the entries encoded since the previous one.
+// Positions are stream positions of the coder that was appended, so a trace continues seamlessly
+// where the previous segment ended.
+// A torn last segment (the writer died mid-append) is ignored and overwritten by the next append().
+//
+
+#pragma once
+
+#include <climits>
+#include <string>
+#include <type_traits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "coder.h"
+
+class Trace {
+public:
+    enum kind_t : uint32_t { mem = 1, reg = 2 };
+
+    static constexpr char     MAGIC[8] = {'C', 'O', 'D', 'E', 'R', 'T', 'R', 'C'};
+    static constexpr uint32_t VERSION  = 2;
+    static constexpr size_t   WINDOW   = size_t(1) << 30; // default address space per spill mapping
+
+    struct Header {
+        char     magic[8];
+        uint32_t version;
+        uint32_t kind;
+        uint32_t mode;
+        uint32_t reserved;
+    };
+    struct Segment {
+        Coder::Pos from;
+        Coder::Pos to;
+        uint64_t   marks;
+    };
+    static_assert(std::has_unique_object_representations_v<Header>, "written byte for byte");
+    static_assert(std::has_unique_object_representations_v<Segment>, "written byte for byte");
+
+    // Opens path, creating it if needed. Check ok(): an existing file has to be a trace of the
+    // same kind and version.
+    Trace(const std::string& path, kind_t kind): kind(kind) {
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0)
+            return;
+
+        Header hdr{};
+        if (file_size() == 0) {
+            std::copy_n(MAGIC, sizeof(MAGIC), hdr.magic);
+            hdr.version = VERSION;
+            hdr.kind    = kind;
+            if (::pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+                return;
+        } else if (::pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) || ! std::equal(MAGIC, MAGIC + sizeof(MAGIC), hdr.magic) ||
+                   hdr.version != VERSION || hdr.kind != kind) {
+            return;
+        }
+        mode = hdr.mode;
+        end  = sizeof(hdr);
+        good = scan();
+    }
+    ~Trace() {
+        if (fd >= 0)
+            ::close(fd);
+    }
+    Trace(const Trace&)            = delete;
+    Trace& operator=(const Trace&) = delete;
+
+    bool ok() {
+        return good;
+    }
+    size_t num_segments() {
+        return segments.size();
+    }
+    // Where the next segment has to start (see append())
+    Coder::Pos back_pos() {
+        return segments.empty() ? Coder::Pos{} : segments.back().to;
+    }
+
+    // Write the entries of c from back_pos() (the first segment: from c's front) to its end as a
+    // new segment. c's live bytes have to cover back_pos().
+    template <typename C>
+    bool append(C& c) {
+        if (! good || kind != kind_of<C>() || ! adopt_mode(c))
+            return false;
+
+        Coder::Pos from = segments.empty() ? c.front_pos() : back_pos();
+        return from.offset == c.back_pos().offset || write_segment(c, from, c.back_pos());
+    }
+
+    // Let c spill its oldest chunks into this trace once its owned chunks exceed budget bytes
+    // (see Coder::set_memory_budget()): each is appended as a segment and replaced by a read-only
+    // view of it. The views point into mappings of window bytes of the file each (reaching past
+    // its end, as the file grows into them), so spilling takes one mapping per window instead of
+    // one per chunk. A failed spill leaves c over its budget (see Coder::within_budget()).
+    // The trace has to be empty or end where c starts, and has to outlive c.
+    template <typename C>
+    bool spill_from(C& c, size_t budget, size_t window = WINDOW) {
+        if (! good || kind != kind_of<C>() || (! segments.empty() && back_pos().offset != c.begin_offset()) || ! adopt_mode(c))
+            return false;
+
+        c.set_memory_budget(budget, Coder::spill);
+        c.spiller = [this, &c, window](Coder::Chunk& ch) {
+            Coder::Pos from = &ch == &c.chunks.front() ? c.front_pos() : ch.from;
+            Coder::Pos to   = c.next(&ch)->from;
+            if (! segments.empty() && back_pos().offset != from.offset)
+                return false;
+
+            size_t at = end;
+            if (! write_segment(c, from, to))
+                return false;
+
+            // a new window once the segment reaches past the current one, starting at the page it begins in
+            if (! view.keep || end > view.offs + view.len) {
+                size_t page = ::sysconf(_SC_PAGESIZE);
+                size_t offs = at / page * page;
+                size_t len  = std::max(window, end - offs);
+                void*  addr = ::mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, offs);
+                if (addr == MAP_FAILED) {
+                    // take the segment back, the chunk stays
+                    segments.pop_back();
+                    end = at;
+                    if (::ftruncate(fd, end) != 0)
+                        good = false;
+                    return false;
+                }
+                std::shared_ptr<const void> keep(addr, [len](const void* p) { ::munmap(const_cast<void*>(p), len); });
+                view = {static_cast<const uint8_t*>(addr), offs, len, std::move(keep)};
+            }
+            c.replace(ch, from, view.data + (at - view.offs) + sizeof(Segment), view.keep);
+            return true;
+        };
+        return true;
+    }
+
+    // Map the file and attach all its segments to c, which has to be empty or end where the
+    // trace starts. An empty c takes over the trace's field mode. The mapping lives as long as c
+    // references it.
+    template <typename C>
+    bool attach(C& c) {
+        if (! good || kind != kind_of<C>())
+            return false;
+        if (segments.empty())
+            return true;
+        if (c.get_size() == 0)
+            c.mode = mode;
+        if (c.get_mode() != mode)
+            return false;
+
+        void* addr = ::mmap(nullptr, end, PROT_READ, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED)
+            return false;
+        std::shared_ptr<const void> keep(addr, [len = end](const void* p) { ::munmap(const_cast<void*>(p), len); });
+
+        auto* p = static_cast<const uint8_t*>(addr) + sizeof(Header);
+        for (auto& seg : segments) {
+            size_t bytes = seg.to.offset - seg.from.offset;
+            auto*  data  = p + sizeof(Segment);
+            std::span<const Coder::Pos> marks(reinterpret_cast<const Coder::Pos*>(data + bytes + pad(bytes)), seg.marks);
+            if (! c.attach(data, seg.from, seg.to, marks, keep))
+                return false;
+            p = data + bytes + pad(bytes) + seg.marks * sizeof(Coder::Pos);
+        }
+        return true;
+    }
+
+private:
+    // The mapping spilled chunks currently point into (see spill_from())
+    struct View {
+        const uint8_t*              data = nullptr;
+        size_t                      offs = 0; // of data in the file
+        size_t                      len  = 0;
+        std::shared_ptr<const void> keep;
+    };
+
+    int                  fd   = -1;
+    kind_t               kind;
+    bool                 good = false;
+    uint32_t             mode = 0;
+    size_t               end  = 0; // end of the last complete segment
+    std::vector<Segment> segments;
+    View                 view;
+
+    // The entries of c between from and to (entry boundaries within its live bytes) as one segment
+    template <typename C>
+    bool write_segment(C& c, Coder::Pos from, Coder::Pos to) {
+        if (from.offset < c.begin_offset() || from.offset > to.offset || from.ordinal > to.ordinal)
+            return false;
+
+        std::vector<Coder::Pos> marks;
+        for (auto& m : c.marks) {
+            if (from.offset <= m.offset && m.offset < to.offset)
+                marks.push_back(m);
+        }
+        Segment seg{from, to, marks.size()};
+        uint8_t zeros[Coder::PADDING + 8]{};
+
+        std::vector<iovec> iov{{&seg, sizeof(seg)}};
+        std::deque<std::vector<uint8_t>> thawed; // compressed chunks, decompressed for the write only
+        for (auto& ch : c.chunks) {
+            size_t head = Coder::head_offset(ch);
+            size_t lo   = std::max(from.offset, head);
+            size_t hi   = std::min(to.offset, head + Coder::live(ch));
+            if (lo >= hi)
+                continue;
+            uint8_t* p = ch.head;
+            if (ch.frozen) {
+                p = thawed.emplace_back(ch.frozen).data();
+                Block::unpack(ch.packed, p, ch.frozen);
+            }
+            iov.push_back({p + (lo - head), hi - lo});
+        }
+        iov.push_back({zeros, pad(to.offset - from.offset)});
+        iov.push_back({marks.data(), marks.size() * sizeof(Coder::Pos)});
+
+        size_t len = 0;
+        for (auto& v : iov)
+            len += v.iov_len;
+        if (! write_all(iov) || ::ftruncate(fd, end + len) != 0)
+            return false;
+
+        end += len;
+        segments.push_back(seg);
+        return true;
+    }
+
+    // The first coder written decides the field mode of the trace, all others have to match it.
+    template <typename C>
+    bool adopt_mode(C& c) {
+        if (! segments.empty() || c.get_mode() == mode)
+            return c.get_mode() == mode;
+        uint32_t m = c.get_mode();
+        if (::pwrite(fd, &m, sizeof(m), offsetof(Header, mode)) != sizeof(m))
+            return false;
+        mode = m;
+        return true;
+    }
+
+    template <typename C>
+    static constexpr kind_t kind_of() {
+        return std::is_same_v<C, MemCoder> ? mem : reg;
+    }
+
+    static size_t pad(size_t bytes) {
+        return Coder::PADDING + (-bytes & 7);
+    }
+
+    size_t file_size() {
+        struct stat st;
+        return ::fstat(fd, &st) == 0 ? st.st_size : 0;
+    }
+
+    // Read the segment headers, stop at the first incomplete or inconsistent one.
+    bool scan() {
+        size_t  size = file_size();
+        Segment seg;
+        while (end + sizeof(seg) <= size && ::pread(fd, &seg, sizeof(seg), end) == sizeof(seg)) {
+            if (seg.to.offset < seg.from.offset || seg.to.ordinal < seg.from.ordinal || seg.marks > size)
+                break;
+            if (! segments.empty() && seg.from.offset != back_pos().offset)
+                break;
+            size_t bytes = seg.to.offset - seg.from.offset;
+            size_t len   = sizeof(seg) + bytes + pad(bytes) + seg.marks * sizeof(Coder::Pos);
+            if (len > size - end)
+                break;
+            segments.push_back(seg);
+            end += len;
+        }
+        return ::ftruncate(fd, end) == 0;
+    }
+
+    bool write_all(std::vector<iovec>& iov) {
+        size_t offs = end;
+        for (size_t i = 0; i < iov.size();) {
+            ssize_t n = ::pwritev(fd, &iov[i], std::min<size_t>(iov.size() - i, IOV_MAX), offs);
+            if (n < 0)
+                return false;
+            offs += n;
+            for (; i < iov.size() && (size_t)n >= iov[i].iov_len; ++i)
+                n -= iov[i].iov_len;
+            if (i < iov.size()) {
+                iov[i].iov_base = static_cast<uint8_t*>(iov[i].iov_base) + n;
+                iov[i].iov_len -= n;
+            }
+        }
+        return true;
+    }
+};
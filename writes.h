@@ -0,0 +1,137 @@
+// Writes
+// MIT License. Copyright 2023 Mirko Palmer (derbroti)
+////////
+
+// Per-address index of the writes in a memory delta log, for reverse watchpoints:
+// "who wrote addr last before clk" and the write history of an address, in O(log n).
+//
+// Only the watched address ranges are indexed, and each address keeps at most its newest
+// `keep` writes. The index is built lazily: update() reads the entries appended to the log since
+// its last call (through an iterator, the log's own cursors stay where they are).
+//
+
+#pragma once
+
+#include <algorithm>
+#include <deque>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "coder.h"
+
+class WriteIndex {
+public:
+    struct Write {
+        uint64_t clk;    // absolute
+        size_t   offset; // of the log entry (see Coder::seek())
+    };
+
+    // Index the writes to [first, last] as well; already indexed writes are kept.
+    void watch(uint32_t first, uint32_t last) {
+        ranges.push_back({first, last});
+        indexed = {};
+    }
+    // keep: writes per address, the oldest ones are dropped beyond it (0 := all)
+    void set_limit(size_t keep) {
+        limit = keep;
+        if (limit) {
+            for (auto& [addr, w] : writes)
+                trim(w);
+        }
+    }
+    void clear() {
+        ranges.clear();
+        writes.clear();
+        indexed = {};
+        front   = 0;
+        count   = 0;
+    }
+
+    bool watched(uint32_t addr) const {
+        return std::ranges::any_of(ranges, [addr](auto& r) { return r.first <= addr && addr <= r.second; });
+    }
+
+    // Catch up with log: index the entries appended since the last update, forget evicted ones.
+    void update(MemCoder& log) {
+        if (ranges.empty())
+            return;
+        if (front < log.begin_offset()) {
+            front = log.begin_offset();
+            for (auto& [addr, w] : writes) {
+                while (! w.empty() && w.front().offset < front) {
+                    w.pop_front();
+                    --count;
+                }
+            }
+        }
+        if (! indexed.ordinal || indexed.offset < front)
+            indexed = log.front_pos();
+
+        for (MemCoder::iterator it(&log, indexed), end = log.end(); it != end; ++it) {
+            MemEntry e = *it;
+            if (watched(e.addr) && ! seen(e.addr, it.pos().offset)) {
+                auto& w = writes[e.addr];
+                w.push_back({it.pos().clk + e.clk, it.pos().offset});
+                ++count;
+                trim(w);
+            }
+        }
+        indexed = log.back_pos();
+    }
+    // The log got truncated to end: forget the writes behind it.
+    void truncate(Coder::Pos end) {
+        for (auto& [addr, w] : writes) {
+            while (! w.empty() && w.back().offset >= end.offset) {
+                w.pop_back();
+                --count;
+            }
+        }
+        if (indexed.offset > end.offset)
+            indexed = end;
+    }
+
+    // The last write to addr in front of clk, if indexed
+    std::optional<Write> last_before(uint32_t addr, uint64_t clk) const {
+        auto it = writes.find(addr);
+        if (it == writes.end())
+            return {};
+        auto w = std::ranges::lower_bound(it->second, clk, {}, &Write::clk);
+        if (w == it->second.begin())
+            return {};
+        return *std::prev(w);
+    }
+    // The indexed writes to addr at clks in [from, to), oldest first
+    std::vector<Write> history(uint32_t addr, uint64_t from, uint64_t to) const {
+        auto it = writes.find(addr);
+        if (it == writes.end())
+            return {};
+        auto& w = it->second;
+        return {std::ranges::lower_bound(w, from, {}, &Write::clk), std::ranges::lower_bound(w, to, {}, &Write::clk)};
+    }
+
+    // Indexed writes over all addresses
+    size_t size() const {
+        return count;
+    }
+
+private:
+    std::vector<std::pair<uint32_t, uint32_t>>      ranges;
+    std::unordered_map<uint32_t, std::deque<Write>> writes;    // by addr, in log order
+    Coder::Pos                                      indexed{}; // indexed up to here (ordinal 0: nothing yet)
+    size_t                                          front = 0; // the log's begin offset, as of the last update
+    size_t                                          limit = 0;
+    size_t                                          count = 0;
+
+    // Rescanning after watch() meets the writes indexed (or trimmed) before again
+    bool seen(uint32_t addr, size_t offset) const {
+        auto it = writes.find(addr);
+        return it != writes.end() && ! it->second.empty() && offset <= it->second.back().offset;
+    }
+    void trim(std::deque<Write>& w) {
+        while (limit && w.size() > limit) {
+            w.pop_front();
+            --count;
+        }
+    }
+};